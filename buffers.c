@@ -0,0 +1,98 @@
+#include "buffers.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+usize buffer_size(usize len, int *class) {
+    usize size = BUFFER_MIN;
+    *class = 0;
+    while (size < len) {
+        size *= 2;
+        *class += 1;
+    }
+    if (*class >= BUFFER_CLASSES) {
+        *class = -1;
+    }
+    return size;
+}
+
+void charge_budget(struct buffer_budget *b, usize len) {
+    __atomic_add_fetch(&b->used, len, __ATOMIC_RELAXED);
+}
+
+void refund_budget(struct buffer_budget *b, usize len) {
+    __atomic_sub_fetch(&b->used, len, __ATOMIC_RELAXED);
+}
+
+void init_buffer_pool(struct buffer_pool *p, struct buffer_budget *budget) {
+    memset(p, 0, sizeof(struct buffer_pool));
+    p->budget = budget;
+}
+
+// FREES EVERY CACHED BUFFER
+void drop_buffer_pool(struct buffer_pool *p) {
+    for (int class = 0; class < BUFFER_CLASSES; ++class) {
+        while (p->free[class]) {
+            byte *buf = p->free[class];
+            memcpy(&p->free[class], buf, sizeof(byte *));
+            free(buf);
+            refund_budget(p->budget, BUFFER_MIN << class);
+        }
+    }
+    p->cached = 0;
+}
+
+// RETURNS A BUFFER OF AT LEAST len BYTES AND STORES ITS SIZE IN capacity.
+// CACHED BUFFERS ARE REUSED FIRST. A NEW ONE THAT WOULD TAKE THE PROCESS PAST
+// ITS BUDGET IS REFUSED WITH NULL UNLESS force IS SET: CALLERS FORCE IT ONLY
+// WHEN THEY CAN'T OTHERWISE MAKE PROGRESS, AND WAIT FOR MEMORY TO COME BACK
+// THE REST OF THE TIME.
+byte *take_buffer(struct buffer_pool *p, usize len, usize *capacity, int force) {
+    int class;
+    usize size = buffer_size(len, &class);
+    if (class >= 0 && p->free[class]) {
+        byte *buf = p->free[class];
+        memcpy(&p->free[class], buf, sizeof(byte *));
+        p->cached -= size;
+        *capacity = size;
+        return buf;
+    }
+
+    if (__atomic_load_n(&p->budget->used, __ATOMIC_RELAXED) + size > p->budget->limit) {
+        // CACHED BUFFERS OF OTHER SIZES COUNT AGAINST THE BUDGET TOO
+        drop_buffer_pool(p);
+        if (!force && __atomic_load_n(&p->budget->used, __ATOMIC_RELAXED) + size > p->budget->limit) {
+            TRACE("refusing %zu byte buffer, over budget", size);
+            return NULL;
+        }
+    }
+
+    byte *buf = malloc(size);
+    if (!buf) {
+        return NULL;
+    }
+    charge_budget(p->budget, size);
+    *capacity = size;
+    return buf;
+}
+
+// HANDS A BUFFER BACK, KEEPING IT FOR REUSE IF THE CACHE HAS ROOM
+void give_buffer(struct buffer_pool *p, byte *buf, usize capacity) {
+    if (!buf) {
+        return;
+    }
+    int class;
+    buffer_size(capacity, &class);
+    if (class >= 0 && p->cached + capacity <= BUFFER_CACHE_MAX) {
+        memcpy(buf, &p->free[class], sizeof(byte *));
+        p->free[class] = buf;
+        p->cached += capacity;
+        return;
+    }
+    free(buf);
+    refund_budget(p->budget, capacity);
+}
+
+int over_budget(struct buffer_pool const *p) {
+    return __atomic_load_n(&p->budget->used, __ATOMIC_RELAXED) > p->budget->limit;
+}
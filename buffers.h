@@ -0,0 +1,36 @@
+#ifndef buffers_h
+#define buffers_h
+#include "typedefs.h"
+
+// CONNECTION BUFFERS COME IN POWER-OF-TWO SIZE CLASSES FROM BUFFER_MIN TO
+// BUFFER_MAX. LARGER BUFFERS ARE STILL ROUNDED UP TO A POWER OF TWO, BUT ARE
+// FREED AS SOON AS THEY ARE HANDED BACK.
+#define BUFFER_MIN          1024
+#define BUFFER_CLASSES      11
+#define BUFFER_MAX          (BUFFER_MIN << (BUFFER_CLASSES - 1))
+// MOST MEMORY ONE POOL KEEPS ON ITS FREE LISTS
+#define BUFFER_CACHE_MAX    (4 << 20)
+
+// LIMITS SHARED BY EVERY EVENT LOOP. used COUNTS BYTES HANDED OUT TO
+// CONNECTIONS PLUS BYTES CACHED ON FREE LISTS, AND IS UPDATED ATOMICALLY.
+struct buffer_budget {
+    usize limit;
+    usize connection_limit;
+    usize used;
+};
+
+// PER-LOOP FREE LISTS, ONE PER SIZE CLASS, LINKED THROUGH THE FIRST BYTES OF
+// EACH FREE BUFFER. ONLY EVER TOUCHED BY ITS OWN LOOP THREAD.
+struct buffer_pool {
+    byte *free[BUFFER_CLASSES];
+    usize cached;
+    struct buffer_budget *budget;
+};
+
+void init_buffer_pool(struct buffer_pool *p, struct buffer_budget *budget);
+void drop_buffer_pool(struct buffer_pool *p);
+byte *take_buffer(struct buffer_pool *p, usize len, usize *capacity, int force);
+void give_buffer(struct buffer_pool *p, byte *buf, usize capacity);
+int over_budget(struct buffer_pool const *p);
+
+#endif
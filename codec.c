@@ -0,0 +1,328 @@
+#include "codec.h"
+#include "wire.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/xattr.h>
+#include <sys/stat.h>
+
+usize chunk_header_len(usize raw_len, usize stored_len) {
+    return varint_len(raw_len) + varint_len(stored_len);
+}
+
+// MOST BYTES ONE ENCODED CHUNK CAN TAKE, HEADER INCLUDED
+usize compressed_chunk_bound() {
+    return 2 * VARINT_MAX + CODEC_CHUNK;
+}
+
+// MOST BYTES compress_part CAN WRITE FOR len PLAIN BYTES. CHUNKS THAT WOULD
+// GROW ARE STORED AS IS, SO ONLY THE CHUNK HEADERS ARE EVER ADDED.
+usize compressed_bound(usize len) {
+    usize chunks = (len + CODEC_CHUNK - 1) / CODEC_CHUNK;
+    return len + chunks * 2 * VARINT_MAX;
+}
+
+// ENCODES len BYTES OF src AS A CODEC_ZLIB PART INTO dst, WHICH MUST HOLD
+// compressed_bound(len) BYTES, AND RETURNS ITS LENGTH. FAVORS SPEED OVER
+// RATIO: THE PART STILL HAS TO KEEP UP WITH THE NETWORK.
+usize compress_part(byte const *src, usize len, byte *dst) {
+    uLong scratch_len = compressBound(CODEC_CHUNK);
+    byte *scratch = malloc(scratch_len);
+    struct wire_writer w = { dst };
+    for (usize done = 0; done < len; ) {
+        usize raw_len = len - done < CODEC_CHUNK ? len - done : CODEC_CHUNK;
+        uLongf stored_len = scratch_len;
+        int err = compress2(scratch, &stored_len, &src[done], raw_len, Z_BEST_SPEED);
+        if (err != Z_OK || stored_len >= raw_len) {
+            put_varint(&w, raw_len);
+            put_varint(&w, raw_len);
+            put_bytes(&w, &src[done], raw_len);
+        } else {
+            put_varint(&w, raw_len);
+            put_varint(&w, stored_len);
+            put_bytes(&w, scratch, stored_len);
+        }
+        done += raw_len;
+    }
+    free(scratch);
+    return w.p - dst;
+}
+
+// DECODES ONE CHUNK'S stored_len BYTES INTO EXACTLY raw_len BYTES OF dst
+int decompress_chunk(byte const *src, usize stored_len, byte *dst, usize raw_len) {
+    if (raw_len > CODEC_CHUNK || stored_len > raw_len) {
+        return -1;
+    }
+    if (stored_len == raw_len) {
+        memcpy(dst, src, raw_len);
+        return 0;
+    }
+    uLongf len = raw_len;
+    if (uncompress(dst, &len, src, stored_len) != Z_OK || len != raw_len) {
+        TRACE("corrupt compressed chunk");
+        return -1;
+    }
+    return 0;
+}
+
+int write_full(int fd, byte const *buf, usize len) {
+    while (len > 0) {
+        isize n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int read_full(int fd, byte *buf, usize len, u64 pos) {
+    while (len > 0) {
+        isize n = pread(fd, buf, len, pos);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+// WHERE ONE CHUNK OF AN ENCODED PART STARTS: ITS FIRST PLAIN BYTE AND THE
+// POSITION OF ITS HEADER IN THE PART FILE
+struct chunk_mark {
+    u64 plain;
+    u64 pos;
+};
+
+// THE CONTENTS OF CHUNKS_XATTR
+struct chunk_index {
+    u64 stride;
+    u64 plain_len;
+    usize count;
+    struct chunk_mark marks[CHUNK_INDEX_MAX];
+};
+
+// READS THE HEADER OF THE CHUNK AT pos. RETURNS 1, 0 AT THE END OF THE PART,
+// OR -1 IF THE HEADER IS MALFORMED OR ITS CHUNK RUNS PAST size.
+int read_chunk_header(int fd, u64 pos, u64 size, u64 *raw_len, u64 *stored_len, usize *header_len) {
+    if (pos == size) {
+        return 0;
+    }
+    byte header[2 * VARINT_MAX];
+    usize want = size - pos < sizeof(header) ? size - pos : sizeof(header);
+    usize raw_bytes, stored_bytes;
+    if (read_full(fd, header, want, pos) != 0
+        || peek_varint(header, want, raw_len, &raw_bytes) != 1
+        || peek_varint(&header[raw_bytes], want - raw_bytes, stored_len, &stored_bytes) != 1)
+    {
+        return -1;
+    }
+    *header_len = raw_bytes + stored_bytes;
+    if (*raw_len > CODEC_CHUNK || *stored_len > *raw_len || *stored_len > size - pos - *header_len) {
+        return -1;
+    }
+    return 1;
+}
+
+// WALKS EVERY CHUNK HEADER OF THE PART, WITHOUT DECODING ANYTHING, MARKING
+// EVERY stride-TH CHUNK AND DROPPING EVERY OTHER MARK WHENEVER THEY RUN OUT
+int build_chunk_index(int fd, struct chunk_index *ix) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    ix->stride = 1;
+    ix->count = 0;
+    u64 pos = 0;
+    u64 plain = 0;
+    for (u64 n = 0; ; ++n) {
+        u64 raw_len, stored_len;
+        usize header_len;
+        int found = read_chunk_header(fd, pos, st.st_size, &raw_len, &stored_len, &header_len);
+        if (found < 0) {
+            TRACE("malformed chunk at %llu", (unsigned long long)pos);
+            return -1;
+        }
+        if (found == 0) {
+            break;
+        }
+        if (n % ix->stride == 0 && ix->count == CHUNK_INDEX_MAX) {
+            for (usize i = 0; i < CHUNK_INDEX_MAX / 2; ++i) {
+                ix->marks[i] = ix->marks[2 * i];
+            }
+            ix->count = CHUNK_INDEX_MAX / 2;
+            ix->stride *= 2;
+        }
+        if (n % ix->stride == 0) {
+            ix->marks[ix->count].plain = plain;
+            ix->marks[ix->count].pos = pos;
+            ix->count += 1;
+        }
+        plain += raw_len;
+        pos += header_len + stored_len;
+    }
+    ix->plain_len = plain;
+    return 0;
+}
+
+int parse_chunk_index(byte const *attr, usize len, struct chunk_index *ix) {
+    struct wire_reader r = { attr, attr + len, 0 };
+    ix->stride = get_varint(&r);
+    ix->plain_len = get_varint(&r);
+    ix->count = get_varint(&r);
+    if (r.error || ix->stride == 0 || ix->count > CHUNK_INDEX_MAX) {
+        return -1;
+    }
+    u64 plain = 0;
+    u64 pos = 0;
+    for (usize i = 0; i < ix->count; ++i) {
+        plain += get_varint(&r);
+        pos += get_varint(&r);
+        ix->marks[i].plain = plain;
+        ix->marks[i].pos = pos;
+    }
+    return r.error ? -1 : 0;
+}
+
+// LOADS THE PART'S CHUNK INDEX, BUILDING AND STORING IT IF IT HAS NONE. A
+// FILESYSTEM THAT WON'T STORE IT ONLY COSTS A WALK OF THE HEADERS EVERY TIME.
+int load_chunk_index(int fd, struct chunk_index *ix) {
+    byte attr[3 * VARINT_MAX + CHUNK_INDEX_MAX * 2 * VARINT_MAX];
+    isize len = fgetxattr(fd, CHUNKS_XATTR, attr, sizeof(attr));
+    if (len > 0 && parse_chunk_index(attr, len, ix) == 0) {
+        return 0;
+    }
+    if (build_chunk_index(fd, ix) != 0) {
+        return -1;
+    }
+
+    struct wire_writer w = { attr };
+    put_varint(&w, ix->stride);
+    put_varint(&w, ix->plain_len);
+    put_varint(&w, ix->count);
+    struct chunk_mark prev = {0};
+    for (usize i = 0; i < ix->count; ++i) {
+        put_varint(&w, ix->marks[i].plain - prev.plain);
+        put_varint(&w, ix->marks[i].pos - prev.pos);
+        prev = ix->marks[i];
+    }
+    if (fsetxattr(fd, CHUNKS_XATTR, attr, w.p - attr, 0) != 0) {
+        TRACE("unable to record chunk index: %s", system_error());
+    }
+    return 0;
+}
+
+// DECODES THE PLAIN BYTES [offset, offset + length) OF THE CODEC_ZLIB PART
+// IN in, CLAMPED TO ITS END, INTO out, FOR CLIENTS THAT CAN'T DECODE IT
+// THEMSELVES. ONLY THE CHUNKS COVERING THE RANGE ARE DECODED, AND AT MOST
+// stride HEADERS BEFORE THEM READ, SO A FEW BYTES OF A HUGE PART COST A
+// CHUNK OR TWO. RETURNS THE NUMBER OF BYTES WRITTEN, OR -1, AND SETS
+// *plain_len TO THE LENGTH OF THE WHOLE PART.
+isize decompress_range(int in, u64 offset, u64 length, int out, u64 *plain_len) {
+    struct chunk_index *ix = malloc(sizeof(struct chunk_index));
+    byte *chunk = malloc(CODEC_CHUNK);
+    byte *plain = malloc(CODEC_CHUNK);
+    struct stat st;
+    isize written = -1;
+    if (fstat(in, &st) != 0 || load_chunk_index(in, ix) != 0) {
+        goto cleanup;
+    }
+    *plain_len = ix->plain_len;
+    if (offset > ix->plain_len) {
+        offset = ix->plain_len;
+    }
+    if (length > ix->plain_len - offset) {
+        length = ix->plain_len - offset;
+    }
+    u64 end = offset + length;
+
+    // THE LAST MARK AT OR BEFORE offset
+    usize i = ix->count;
+    while (i > 1 && ix->marks[i - 1].plain > offset) {
+        i -= 1;
+    }
+    u64 pos = i > 0 ? ix->marks[i - 1].pos : 0;
+    u64 at = i > 0 ? ix->marks[i - 1].plain : 0;
+    written = 0;
+    while (at < end) {
+        u64 raw_len, stored_len;
+        usize header_len;
+        if (read_chunk_header(in, pos, st.st_size, &raw_len, &stored_len, &header_len) != 1) {
+            written = -1;
+            break;
+        }
+        if (at + raw_len > offset) {
+            u64 from = offset > at ? offset - at : 0;
+            u64 to = end < at + raw_len ? end - at : raw_len;
+            if (read_full(in, chunk, stored_len, pos + header_len) != 0
+                || decompress_chunk(chunk, stored_len, plain, raw_len) != 0
+                || write_full(out, &plain[from], to - from) != 0)
+            {
+                written = -1;
+                break;
+            }
+            written += to - from;
+        }
+        at += raw_len;
+        pos += header_len + stored_len;
+    }
+
+cleanup:
+    if (written < 0) {
+        TRACE("unable to decompress part");
+    }
+    free(ix);
+    free(chunk);
+    free(plain);
+    return written;
+}
+
+// RETURNS THE CODEC OF A STORED PART, AND IF plain_len ISN'T NULL, THE
+// LENGTH IT DECODES TO, OR 0 IF THAT WASN'T RECORDED
+byte stored_codec(int fd, u64 *plain_len) {
+    byte attr[1 + VARINT_MAX];
+    isize len = fgetxattr(fd, CODEC_XATTR, attr, sizeof(attr));
+    if (plain_len) {
+        *plain_len = 0;
+    }
+    if (len < 1) {
+        return CODEC_NONE;
+    }
+    if (plain_len) {
+        struct wire_reader r = { &attr[1], &attr[len], 0 };
+        *plain_len = get_optional(&r);
+    }
+    return attr[0];
+}
+
+// RECORDS THE CODEC OF A PART JUST OPENED FOR WRITING, AND THE LENGTH IT
+// DECODES TO IF THE CLIENT SENT IT. A PLAIN PART DROPS ANY CODEC LEFT BY THE
+// FILE IT REPLACES, AND EVERY PART DROPS ITS CHUNK INDEX.
+int store_codec(int fd, byte codec, u64 plain_len) {
+    if (fremovexattr(fd, CHUNKS_XATTR) != 0 && errno != ENODATA && errno != ENOTSUP) {
+        return -1;
+    }
+    if (codec == CODEC_NONE) {
+        if (fremovexattr(fd, CODEC_XATTR) != 0 && errno != ENODATA && errno != ENOTSUP) {
+            return -1;
+        }
+        return 0;
+    }
+    byte attr[1 + VARINT_MAX];
+    struct wire_writer w = { attr };
+    put_byte(&w, codec);
+    put_optional(&w, plain_len);
+    return fsetxattr(fd, CODEC_XATTR, attr, w.p - attr, 0);
+}
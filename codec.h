@@ -0,0 +1,49 @@
+#ifndef codec_h
+#define codec_h
+#include "typedefs.h"
+
+// HOW A PART'S BYTES ARE ENCODED, ON THE WIRE AND ON DISK. REQUESTS THAT
+// ACCEPT ENCODED BODIES CARRY A BITMASK WITH BIT codec SET FOR EACH ONE.
+#define CODEC_NONE      0
+#define CODEC_ZLIB      1
+#define CODEC_MAX       CODEC_ZLIB
+#define CODEC_BIT(c)    (1 << (c))
+
+// A CODEC_ZLIB PART IS A SEQUENCE OF INDEPENDENT CHUNKS OF UP TO CODEC_CHUNK
+// PLAIN BYTES EACH, SO IT CAN BE DECODED AS IT ARRIVES AND WITH BOUNDED
+// MEMORY:
+//
+//     raw_len stored_len bytes
+//
+// WHERE raw_len AND stored_len ARE VARINTS. A CHUNK THAT DOESN'T SHRINK IS
+// STORED AS IS, WITH stored_len EQUAL TO raw_len; ANY OTHER IS A zlib
+// STREAM.
+#define CODEC_CHUNK     65536
+
+// EXTENDED ATTRIBUTE RECORDING THE CODEC OF A STORED PART AS A BYTE,
+// FOLLOWED BY THE VARINT LENGTH IT DECODES TO WHEN THAT IS KNOWN. PARTS
+// WITHOUT IT ARE PLAIN.
+#define CODEC_XATTR     "user.dfs.codec"
+
+// EXTENDED ATTRIBUTE INDEXING WHERE THE CHUNKS OF AN ENCODED PART START, SO
+// A RANGE OF IT CAN BE DECODED WITHOUT DECODING EVERYTHING BEFORE IT:
+//
+//     stride plain_len count (plain pos)...
+//
+// ALL VARINTS, WITH ONE (plain pos) PAIR FOR EVERY stride-TH CHUNK FROM THE
+// FIRST, EACH GIVING ITS FIRST PLAIN BYTE AND THE POSITION OF ITS HEADER AS
+// DELTAS FROM THE PAIR BEFORE. stride DOUBLES AS THE PART GROWS, SO THERE ARE
+// NEVER MORE THAN CHUNK_INDEX_MAX PAIRS. BUILT THE FIRST TIME THE PART IS
+// READ A RANGE AT A TIME, AND DROPPED WHENEVER IT IS PUT AGAIN.
+#define CHUNKS_XATTR    "user.dfs.chunks"
+#define CHUNK_INDEX_MAX 128
+
+usize compressed_bound(usize len);
+usize compressed_chunk_bound();
+usize compress_part(byte const *src, usize len, byte *dst);
+int decompress_chunk(byte const *src, usize stored_len, byte *dst, usize raw_len);
+isize decompress_range(int in, u64 offset, u64 length, int out, u64 *plain_len);
+byte stored_codec(int fd, u64 *plain_len);
+int store_codec(int fd, byte codec, u64 plain_len);
+
+#endif
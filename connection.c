@@ -1,13 +1,344 @@
 #include "connection.h"
+#include "log.h"
+#include "pool.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <assert.h>
+#include <sys/socket.h>
 
 void drop_connection(struct connection *c) {
     if (c) {
         close(c->fd);
-        free(c->read.buf);
-        free(c->write.buf);
+        if (c->upload.pipe[0] > 0) {
+            close(c->upload.pipe[0]);
+            close(c->upload.pipe[1]);
+        }
+        if (c->buffers) {
+            give_buffer(c->buffers, c->read.buf, c->read.capacity);
+            give_buffer(c->buffers, c->write.buf, c->write.capacity);
+        }
         memset(c, 0, sizeof(struct connection));
     }
 }
+
+// MAKES ROOM FOR len MORE BYTES AT THE END OF THE READ BUFFER, BY MOVING THE
+// UNPARSED BYTES TO THE FRONT OR BY MOVING THEM TO A BUFFER FROM A LARGER
+// SIZE CLASS. RETURNS -1 IF THAT WOULD TAKE THE UNPARSED BYTES PAST max, OR
+// IF THE POOL REFUSED A NEW BUFFER (SEE take_buffer FOR force).
+int reserve_read(struct connection *c, usize len, usize max, int force) {
+    usize unparsed = c->read.end - c->read.parse_idx;
+    if (c->read.capacity - c->read.end >= len) {
+        return 0;
+    }
+    if (c->read.capacity - unparsed >= len) {
+        memmove(c->read.buf, &c->read.buf[c->read.parse_idx], unparsed);
+        c->read.parse_idx = 0;
+        c->read.end = unparsed;
+        return 0;
+    }
+    if (unparsed + len > max) {
+        return -1;
+    }
+
+    usize capacity;
+    byte *buf = take_buffer(c->buffers, unparsed + len, &capacity, force);
+    if (!buf) {
+        return -1;
+    }
+    if (unparsed > 0) {
+        memcpy(buf, &c->read.buf[c->read.parse_idx], unparsed);
+    }
+    give_buffer(c->buffers, c->read.buf, c->read.capacity);
+    c->read.buf = buf;
+    c->read.capacity = capacity;
+    c->read.parse_idx = 0;
+    c->read.end = unparsed;
+    return 0;
+}
+
+// MARKS len BYTES AS PARSED, HANDING THE BUFFER BACK ONCE NOTHING IS LEFT
+void consume_read(struct connection *c, usize len) {
+    c->read.parse_idx += len;
+    if (c->read.parse_idx == c->read.end) {
+        give_buffer(c->buffers, c->read.buf, c->read.capacity);
+        c->read.buf = NULL;
+        c->read.capacity = 0;
+        c->read.parse_idx = 0;
+        c->read.end = 0;
+    }
+}
+
+// MAKES ROOM FOR len MORE BYTES OF RESPONSE. RESPONSES ARE ALREADY MADE BY
+// THE TIME THEY ARE QUEUED, SO THIS NEVER FAILS: BACKPRESSURE IS APPLIED
+// BEFORE DISPATCH INSTEAD, THROUGH write_backlogged. MUST NOT BE CALLED
+// WHILE A SEND IS USING THE BUFFER.
+void reserve_write(struct connection *c, usize len) {
+    usize unsent = c->write.end - c->write.start;
+    if (c->write.capacity - c->write.end >= len) {
+        return;
+    }
+    if (c->write.capacity - unsent >= len) {
+        memmove(c->write.buf, &c->write.buf[c->write.start], unsent);
+        c->write.start = 0;
+        c->write.end = unsent;
+        return;
+    }
+
+    usize capacity;
+    byte *buf = take_buffer(c->buffers, unsent + len, &capacity, 1);
+    if (unsent > 0) {
+        memcpy(buf, &c->write.buf[c->write.start], unsent);
+    }
+    give_buffer(c->buffers, c->write.buf, c->write.capacity);
+    c->write.buf = buf;
+    c->write.capacity = capacity;
+    c->write.start = 0;
+    c->write.end = unsent;
+}
+
+// HANDS THE WRITE BUFFER BACK ONCE EVERYTHING IN IT HAS BEEN SENT
+void release_write(struct connection *c) {
+    if (c->write.buf && c->write.end == c->write.start) {
+        give_buffer(c->buffers, c->write.buf, c->write.capacity);
+        c->write.buf = NULL;
+        c->write.capacity = 0;
+        c->write.start = 0;
+        c->write.end = 0;
+    }
+}
+
+// SAYS WHETHER THE CONNECTION HAS MORE UNSENT RESPONSE BYTES THAN ITS BUDGET
+// ALLOWS. WHILE IT DOES, THE CONNECTION STOPS READING AND DISPATCHING UNTIL
+// ITS PEER CATCHES UP.
+int write_backlogged(struct connection const *c) {
+    return c->write.end - c->write.start >= c->buffers->budget->connection_limit;
+}
+
+// PARSES THE NEXT COMPLETE REQUEST OUT OF THE READ BUFFER. RETURNS 1 IF A
+// REQUEST WAS PARSED INTO r, 0 IF MORE BYTES ARE NEEDED, -1 IF THE BYTES ARE
+// NOT A REQUEST, IN WHICH CASE THE CONNECTION IS HUNG UP AND SHUT DOWN SO
+// THE EVENT LOOP SEES IT CLOSE. THE FIRST BYTE PICKS
+// THE WIRE VERSION, SO V1 AND V2 CLIENTS ARE SERVED SIDE BY SIDE AND EACH IS
+// ANSWERED IN ITS OWN VERSION. A PUT IS RETURNED AS SOON AS ITS PATH HAS
+// ARRIVED, WITH put.file.buf LEFT NULL: THE put.file.len BODY BYTES THAT
+// FOLLOW ARE LEFT IN THE BUFFER FOR THE EVENT LOOP TO STREAM TO DISK.
+int parse_request(struct connection *c, struct request *r) {
+    byte const *buf = &c->read.buf[c->read.parse_idx];
+    usize const len = c->read.end - c->read.parse_idx;
+    if (len == 0) {
+        return 0;
+    }
+
+    usize frame_len = 0;
+    int parsed;
+    switch (buf[0]) {
+    case WIRE_START_V2:
+        parsed = parse_request_v2(buf, len, r, &frame_len);
+        break;
+    case REQUEST_START:
+        parsed = parse_request_v1(buf, len, r, &frame_len);
+        break;
+    default:
+        TRACE("unknown request start byte %#x", buf[0]);
+        parsed = -1;
+    }
+    if (parsed == -1) {
+        c->hup = 1;
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    if (parsed != 1) {
+        return parsed;
+    }
+
+    print_request(r);
+    consume_read(c, frame_len);
+    return 1;
+}
+
+// SAYS WHETHER A REQUEST OF THIS TYPE CHANGES THE FILESYSTEM
+int is_write_request(byte type) {
+    return type == PUT || type == MKDIR;
+}
+
+// SAYS WHETHER THE NEXT BUFFERED REQUEST MAY BE DISPATCHED ALONGSIDE THE ONES
+// ALREADY IN FLIGHT. GET AND LIST RUN IN PARALLEL, BUT PUT AND MKDIR WAIT FOR
+// EVERYTHING BEFORE THEM TO BE ANSWERED AND HOLD BACK EVERYTHING AFTER THEM,
+// SO NO REQUEST EVER SEES THE FILESYSTEM HALFWAY THROUGH AN EARLIER WRITE.
+int can_dispatch(struct connection const *c) {
+    if (c->hup || c->upload.active || c->pipeline.len >= MAX_PIPELINE || write_backlogged(c)) {
+        return 0;
+    }
+    int busy = c->pipeline.len > 0 || c->download.job;
+    if (!busy) {
+        return 1;
+    }
+    if (c->pipeline.tail && is_write_request(c->pipeline.tail->req.type)) {
+        return 0;
+    }
+    // BOTH WIRE VERSIONS CARRY THE TYPE IN THE SECOND BYTE
+    if (c->read.end - c->read.parse_idx < 2) {
+        return 0;
+    }
+    return !is_write_request(c->read.buf[c->read.parse_idx + 1] & ~REQUEST_TAGGED);
+}
+
+// RESOLVES WHO A REQUEST RUNS AS. ONE WITH AN EMPTY USERNAME RUNS AS THE
+// SESSION USER, SO A CLIENT THAT HAS LOGGED IN PAYS NOTHING PER REQUEST FOR
+// AUTHENTICATION. A LOGIN REPLACES THE SESSION USER, OR CLEARS IT IF ITS
+// CREDENTIALS ARE WRONG. REQUESTS ARE RESOLVED AS THEY ARE DISPATCHED, IN
+// ORDER, SO EVERY REQUEST PIPELINED BEHIND A LOGIN SEES ITS OUTCOME.
+struct user *authenticate(struct connection *c, struct users const *users, struct request const *r) {
+    if (r->type == LOGIN) {
+        c->user = check_identity(users, r->username, r->password);
+        return c->user;
+    }
+    if (r->username[0] == '\0') {
+        return c->user;
+    }
+    return check_identity(users, r->username, r->password);
+}
+
+void push_pipeline(struct connection *c, struct job *j) {
+    j->pipeline_next = NULL;
+    j->state = JOB_RUNNING;
+    if (c->pipeline.tail) {
+        c->pipeline.tail->pipeline_next = j;
+    } else {
+        c->pipeline.head = j;
+    }
+    c->pipeline.tail = j;
+    c->pipeline.len += 1;
+    c->pending += 1;
+}
+
+// UNLINKS THE JOB AFTER prev, OR THE HEAD IF prev IS NULL
+struct job *unlink_pipeline(struct connection *c, struct job *prev) {
+    struct job *j = prev ? prev->pipeline_next : c->pipeline.head;
+    if (prev) {
+        prev->pipeline_next = j->pipeline_next;
+    } else {
+        c->pipeline.head = j->pipeline_next;
+    }
+    if (c->pipeline.tail == j) {
+        c->pipeline.tail = prev;
+    }
+    c->pipeline.len -= 1;
+    j->pipeline_next = NULL;
+    return j;
+}
+
+struct job *pop_pipeline(struct connection *c) {
+    return unlink_pipeline(c, NULL);
+}
+
+// FINDS THE NEXT FINISHED JOB THAT MAY BE ANSWERED: THE HEAD OF THE PIPELINE,
+// OR ANY TAGGED JOB, WHOSE CLIENT MATCHES RESPONSES BY id. STORES THE JOB
+// BEFORE IT IN prev. A SLOW REQUEST THEN ONLY HOLDS UP THE UNTAGGED ONES
+// BEHIND IT.
+struct job *next_answerable(struct connection const *c, struct job **prev) {
+    *prev = NULL;
+    for (struct job *j = c->pipeline.head; j; j = j->pipeline_next) {
+        if (j->state == JOB_DONE && (j == c->pipeline.head || j->req.tagged)) {
+            return j;
+        }
+        *prev = j;
+    }
+    return NULL;
+}
+
+// QUEUES THE RESPONSES OF EVERY JOB THAT CAN BE ANSWERED INTO THE WRITE
+// BUFFER, SO EVERYTHING READY GOES OUT IN ONE WRITE. STOPS WHEN NO FINISHED
+// JOB IS LEFT THAT MAY GO NEXT, OR AT THE FIRST BODY THAT HAS TO FOLLOW FROM
+// A PART FILE. RETURNS THE NUMBER OF RESPONSES QUEUED.
+int queue_responses(struct connection *c) {
+    int queued = 0;
+    struct job *prev;
+    while (!c->hup && !c->download.job && next_answerable(c, &prev)) {
+        struct job *j = unlink_pipeline(c, prev);
+        queue_response(c, &j->res);
+        queued += 1;
+        c->download.job = j;
+        c->download.part = 0;
+        next_download(c);
+    }
+    return queued;
+}
+
+void start_download(struct connection *c, struct response const *res) {
+    c->download.fd = res->fd;
+    c->download.offset = res->get.offset;
+    c->download.remaining = res->get.file.len;
+}
+
+// QUEUES THE HEADER OF A GET_MULTI PART, AND ITS BODY IF IT WAS INLINED
+void queue_multi_part(struct connection *c, struct response const *part) {
+    int inline_body = part->status == SUCCESS && part->fd <= 0;
+    usize len = multi_part_header_len(part) + (inline_body ? part->get.file.len : 0);
+    reserve_write(c, len);
+    usize header_len = serialize_multi_part_header(part, &c->write.buf[c->write.end]);
+    if (inline_body) {
+        memcpy(&c->write.buf[c->write.end + header_len], part->get.file.buf, part->get.file.len);
+    }
+    c->write.end += len;
+}
+
+// MOVES THE DOWNLOAD ON TO THE NEXT BODY ITS JOB SENDS FROM A PART FILE,
+// QUEUEING THE HEADERS OF ANY GET_MULTI PARTS IT PASSES ON THE WAY. ONCE
+// NOTHING IS LEFT TO SEND FROM DISK, DROPS THE JOB AND RETURNS 0.
+int next_download(struct connection *c) {
+    struct job *j = c->download.job;
+    struct response const *res = &j->res;
+    if (has_get_body(res->type) && c->download.part == 0) {
+        c->download.part = 1;
+        if (res->status == SUCCESS && res->fd > 0) {
+            start_download(c, res);
+            return 1;
+        }
+    }
+    while (res->type == GET_MULTI && c->download.part < res->get_multi.count) {
+        struct response const *part = &res->get_multi.parts[c->download.part];
+        c->download.part += 1;
+        queue_multi_part(c, part);
+        if (part->status == SUCCESS && part->fd > 0) {
+            start_download(c, part);
+            return 1;
+        }
+    }
+    drop_job(j);
+    c->download.job = NULL;
+    c->download.fd = 0;
+    return 0;
+}
+
+// DROPS EVERY JOB A CLOSING CONNECTION STILL OWNS. JOBS STILL HELD BY A
+// WORKER ARE UNLINKED HERE AND DROPPED WHEN THEY COME BACK.
+void abandon_pipeline(struct connection *c) {
+    while (c->pipeline.head) {
+        struct job *j = pop_pipeline(c);
+        if (j->state != JOB_RUNNING) {
+            drop_job(j);
+        }
+    }
+    c->upload.job = NULL;
+    c->upload.active = 0;
+    drop_job(c->download.job);
+    c->download.job = NULL;
+}
+
+// QUEUES A RESPONSE INTO THE WRITE BUFFER. A GET WITH AN OPEN PART FILE ONLY
+// QUEUES ITS HEADER: THE EVENT LOOP SENDS THE BODY STRAIGHT FROM THE FILE.
+void queue_response(struct connection *c, struct response const *res) {
+    usize reslen = responselen(res);
+    if (has_get_body(res->type) && res->fd > 0) {
+        reslen -= res->get.file.len;
+    }
+    reserve_write(c, reslen);
+    print_response(res);
+    if (has_get_body(res->type) && res->fd > 0) {
+        serialize_response_header(res, &c->write.buf[c->write.end]);
+    } else {
+        serialize_response(res, &c->write.buf[c->write.end]);
+    }
+    c->write.end += reslen;
+}
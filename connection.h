@@ -1,9 +1,31 @@
 #ifndef connection_h
 #define connection_h
 #include "typedefs.h"
+#include "request.h"
+#include "response.h"
+#include "buffers.h"
+#include "users.h"
+
+// MOST REQUESTS A CONNECTION CAN HAVE DISPATCHED AT ONCE
+#define MAX_PIPELINE    16
+
+struct job;
 
 struct connection {
     int fd;
+    // SLAB HANDLE THE EVENT LOOP KNOWS THIS CONNECTION BY
+    u64 handle;
+    // JOBS STILL HELD BY A WORKER
+    int pending;
+    int hup;
+    // SESSION USER SET BY LOGIN, WHICH REQUESTS WITH NO USERNAME RUN AS
+    struct user *user;
+    // POOL THE READ AND WRITE BUFFERS COME FROM. EITHER BUFFER IS HANDED BACK
+    // AS SOON AS IT DRAINS, SO AN IDLE CONNECTION HOLDS NO BUFFER MEMORY.
+    struct buffer_pool *buffers;
+    // SET WHILE ON THE EVENT LOOP'S LIST OF CONNECTIONS WITH FINISHED JOBS
+    int ready;
+    struct connection *next_ready;
     struct {
         byte *buf;
         usize parse_idx;
@@ -16,8 +38,46 @@ struct connection {
         usize end;
         usize capacity;
     } write;
+    // PUT BODY BEING STREAMED FROM THE SOCKET TO THE PART FILE
+    struct {
+        int active;
+        usize remaining;
+        struct job *job;
+        int pipe[2];
+    } upload;
+    // REQUESTS DISPATCHED AND NOT YET ANSWERED, OLDEST FIRST. UNTAGGED
+    // RESPONSES ARE ONLY EVER QUEUED FROM THE FRONT, SO THEY GO OUT IN
+    // REQUEST ORDER EVEN THOUGH THE WORKERS MAY FINISH THEM IN ANY ORDER.
+    // TAGGED ONES ARE QUEUED FROM WHEREVER THEY ARE AS SOON AS THEY FINISH.
+    struct {
+        struct job *head;
+        struct job *tail;
+        usize len;
+    } pipeline;
+    // GET BODY BEING SENT FROM A PART FILE AFTER ITS HEADER. part IS THE
+    // NEXT GET_MULTI PART WHOSE HEADER HASN'T BEEN QUEUED YET.
+    struct {
+        struct job *job;
+        int fd;
+        off_t offset;
+        usize remaining;
+        usize part;
+    } download;
 };
 
 void drop_connection(struct connection *c);
+int reserve_read(struct connection *c, usize len, usize max, int force);
+void consume_read(struct connection *c, usize len);
+void reserve_write(struct connection *c, usize len);
+void release_write(struct connection *c);
+int write_backlogged(struct connection const *c);
+int parse_request(struct connection *c, struct request *r);
+int can_dispatch(struct connection const *c);
+struct user *authenticate(struct connection *c, struct users const *users, struct request const *r);
+void push_pipeline(struct connection *c, struct job *j);
+int queue_responses(struct connection *c);
+int next_download(struct connection *c);
+void abandon_pipeline(struct connection *c);
+void queue_response(struct connection *c, struct response const *res);
 
 #endif
@@ -0,0 +1,165 @@
+#include "crc32c.h"
+#include "log.h"
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/xattr.h>
+#ifdef __x86_64__
+#include <nmmintrin.h>
+#endif
+
+// CASTAGNOLI POLYNOMIAL, BIT-REVERSED
+#define CRC32C_POLY     0x82f63b78
+// BYTES IN EACH OF THE THREE STREAMS THE HARDWARE PATH INTERLEAVES
+#define CRC32C_STRIDE   8192
+
+// SLICING-BY-8 TABLES FOR CPUS WITHOUT THE crc32 INSTRUCTION
+u32 crc32c_table[8][256];
+// x^(8 * CRC32C_STRIDE) AND x^(16 * CRC32C_STRIDE) MOD THE POLYNOMIAL
+u32 crc32c_shift1;
+u32 crc32c_shift2;
+u32 (*crc32c_impl)(u32 crc, byte const *p, usize len);
+pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// a * b MOD THE POLYNOMIAL, BOTH BIT-REVERSED
+u32 crc32c_multiply(u32 a, u32 b) {
+    u32 product = 0;
+    for (u32 m = (u32)1 << 31; m; m >>= 1) {
+        if (a & m) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+// x^(8 * len) MOD THE POLYNOMIAL: MULTIPLYING A CRC BY IT HAS THE SAME EFFECT
+// AS FEEDING len ZERO BYTES THROUGH IT
+u32 crc32c_zeroes(usize len) {
+    u32 power = (u32)1 << 31;
+    // x^8
+    u32 square = (u32)1 << 23;
+    for (; len; len >>= 1) {
+        if (len & 1) {
+            power = crc32c_multiply(power, square);
+        }
+        square = crc32c_multiply(square, square);
+    }
+    return power;
+}
+
+u64 load_u64(byte const *p) {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+u32 crc32c_portable(u32 crc, byte const *p, usize len) {
+    while (len > 0 && ((usize)p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len -= 1;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        u64 v = load_u64(p) ^ crc;
+        crc = crc32c_table[7][v & 0xff] ^ crc32c_table[6][(v >> 8) & 0xff]
+            ^ crc32c_table[5][(v >> 16) & 0xff] ^ crc32c_table[4][(v >> 24) & 0xff]
+            ^ crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff]
+            ^ crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+    }
+    while (len > 0) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len -= 1;
+    }
+    return crc;
+}
+
+#ifdef __x86_64__
+// ONE crc32 INSTRUCTION TAKES 3 CYCLES BUT A NEW ONE CAN START EVERY CYCLE,
+// SO LONG BUFFERS ARE CUT INTO THREE STREAMS WORKED ON AT ONCE, AND THEIR
+// CRCS STITCHED BACK TOGETHER BY SHIFTING THE FIRST TWO PAST THE STREAMS
+// AFTER THEM. THE SHIFTS ARE TWO MULTIPLIES PER 24 KB, WHICH IS NOISE.
+__attribute__((target("sse4.2")))
+u32 crc32c_sse42(u32 crc, byte const *p, usize len) {
+    while (len > 0 && ((usize)p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len -= 1;
+    }
+    while (len >= 3 * CRC32C_STRIDE) {
+        u64 a = crc;
+        u64 b = 0;
+        u64 c = 0;
+        for (byte const *end = p + CRC32C_STRIDE; p < end; p += 8) {
+            a = _mm_crc32_u64(a, load_u64(p));
+            b = _mm_crc32_u64(b, load_u64(p + CRC32C_STRIDE));
+            c = _mm_crc32_u64(c, load_u64(p + 2 * CRC32C_STRIDE));
+        }
+        crc = crc32c_multiply(a, crc32c_shift2) ^ crc32c_multiply(b, crc32c_shift1) ^ c;
+        p += 2 * CRC32C_STRIDE;
+        len -= 3 * CRC32C_STRIDE;
+    }
+    u64 v = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        v = _mm_crc32_u64(v, load_u64(p));
+    }
+    crc = v;
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len -= 1;
+    }
+    return crc;
+}
+#endif
+
+void init_crc32c() {
+    for (u32 n = 0; n < 256; ++n) {
+        u32 crc = n;
+        for (int k = 0; k < 8; ++k) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for (u32 n = 0; n < 256; ++n) {
+        for (int k = 1; k < 8; ++k) {
+            u32 prev = crc32c_table[k - 1][n];
+            crc32c_table[k][n] = crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+        }
+    }
+    crc32c_shift1 = crc32c_zeroes(CRC32C_STRIDE);
+    crc32c_shift2 = crc32c_zeroes(2 * CRC32C_STRIDE);
+
+    crc32c_impl = crc32c_portable;
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_impl = crc32c_sse42;
+    }
+#endif
+    TRACE("crc32c using %s", crc32c_impl == crc32c_portable ? "tables" : "sse4.2");
+}
+
+// EXTENDS crc, WHICH IS 0 TO START, WITH len BYTES OF buf. A BUFFER CAN BE
+// CHECKED IN PIECES BY PASSING EACH PIECE THE CRC OF THE ONES BEFORE IT.
+u32 crc32c(u32 crc, void const *buf, usize len) {
+    pthread_once(&crc32c_once, init_crc32c);
+    return ~crc32c_impl(~crc, buf, len);
+}
+
+u64 stored_checksum(int fd) {
+    byte crc[4];
+    if (fgetxattr(fd, CHECKSUM_XATTR, crc, sizeof(crc)) != sizeof(crc)) {
+        return 0;
+    }
+    return CHECKSUM_SET | (u32)crc[0] | (u32)crc[1] << 8 | (u32)crc[2] << 16 | (u32)crc[3] << 24;
+}
+
+// RECORDS THE CHECKSUM OF A PART JUST OPENED FOR WRITING, OR DROPS ANY LEFT
+// BY THE FILE IT REPLACES IF checksum IS 0
+int store_checksum(int fd, u64 checksum) {
+    if (!(checksum & CHECKSUM_SET)) {
+        if (fremovexattr(fd, CHECKSUM_XATTR) != 0 && errno != ENODATA && errno != ENOTSUP) {
+            return -1;
+        }
+        return 0;
+    }
+    byte crc[4] = { checksum, checksum >> 8, checksum >> 16, checksum >> 24 };
+    return fsetxattr(fd, CHECKSUM_XATTR, crc, sizeof(crc), 0);
+}
@@ -0,0 +1,19 @@
+#ifndef crc32c_h
+#define crc32c_h
+#include "typedefs.h"
+
+// EVERY PART IS CHECKED END TO END WITH A CRC32C OF ITS PLAIN BYTES, WORKED
+// OUT BY THE CLIENT THAT PUTS IT AND VERIFIED BY THE CLIENT THAT GETS IT.
+// ON THE WIRE A CHECKSUM IS THE CRC WITH CHECKSUM_SET OR'D IN, SO THAT A
+// CHECKSUM OF 0 CAN MEAN THERE IS NONE.
+#define CHECKSUM_SET        ((u64)1 << 32)
+
+// EXTENDED ATTRIBUTE HOLDING THE CRC OF A STORED PART, 4 BYTES LITTLE-ENDIAN.
+// PARTS WITHOUT IT ARE NEVER VERIFIED.
+#define CHECKSUM_XATTR      "user.dfs.crc32c"
+
+u32 crc32c(u32 crc, void const *buf, usize len);
+u64 stored_checksum(int fd);
+int store_checksum(int fd, u64 checksum);
+
+#endif
@@ -9,18 +9,49 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <assert.h>
 #include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+// MOST IDLE CONNECTIONS KEPT OPEN TO EACH SERVER. A GET CAN HAVE TWO
+// REQUESTS RUNNING ON ONE SERVER AT ONCE, SO MORE THAN ONE IS KEPT.
+#define POOL_MAX 4
+// A SERVER THAT FAILS THIS MANY TIMES IN A ROW HAS ITS CIRCUIT OPENED: IT
+// IS SKIPPED OUTRIGHT UNTIL ITS BACKOFF PASSES, THEN GIVEN ONE REQUEST AS A
+// PROBE. EACH FAILED PROBE DOUBLES THE BACKOFF, UP TO BACKOFF_MAX_MS.
+#define CIRCUIT_FAILURES    2
+#define BACKOFF_MIN_MS      1000
+#define BACKOFF_MAX_MS      60000
+// EACH ROUND TRIP MOVES A SERVER'S LATENCY AVERAGE 1/LATENCY_WEIGHT OF THE WAY
+#define LATENCY_WEIGHT      8
+// A REPLICA IS ONLY PASSED OVER FOR BEING SLOW WHEN IT IS THIS MANY TIMES
+// SLOWER THAN THE OTHER
+#define LATENCY_SKEW        4
 
 struct server {
     struct sockaddr_in addr;
     char *ip;
     char *port;
+    // CONNECTIONS LEFT OPEN BY FINISHED EXCHANGES, NEWEST LAST, FOR LATER
+    // REQUESTS AND COMMANDS TO REUSE INSTEAD OF CONNECTING AGAIN. GUARDED BY
+    // lock, SINCE PUTS AND GETS RUN A THREAD PER REQUEST.
+    int idle[POOL_MAX];
+    int num_idle;
+    // HOW THE SERVER HAS BEEN DOING, ALSO GUARDED BY lock. latency_us IS AN
+    // EXPONENTIALLY WEIGHTED AVERAGE OF METADATA ROUND TRIPS, 0 UNTIL THE
+    // FIRST. THE CIRCUIT IS OPEN WHILE failures >= CIRCUIT_FAILURES.
+    u64 latency_us;
+    int failures;
+    u64 backoff_ms;
+    u64 open_until;
+    pthread_mutex_t lock;
 };
 
-int read_conf(char const *conf_path, char **username, char **password, struct server *dfs) {
+int read_conf(char const *conf_path, char **username, char **password, u64 *codec, struct server *dfs) {
     FILE *file = fopen(conf_path, "r");
     if (!file) {
         return -1;
@@ -55,6 +86,9 @@ int read_conf(char const *conf_path, char **username, char **password, struct se
         } else if (strcmp(token, "Password:") == 0) {
             token = strtok_r(NULL, " \n", &save);
             *password = strdup(token);
+        } else if (strcmp(token, "Compression:") == 0) {
+            token = strtok_r(NULL, " \n", &save);
+            *codec = token && strcmp(token, "zlib") == 0 ? CODEC_ZLIB : CODEC_NONE;
         } else {
             continue;
         }
@@ -69,248 +103,1292 @@ int read_conf(char const *conf_path, char **username, char **password, struct se
 
 #define CONNECT_TIMEOUT_MS 1000
 
-int put_file(char const *username,
-             char const *password,
-             struct server dfs[4],
-             char const *path,
-             byte const *file,
-             usize file_len)
-{
-    usize mod = md5_mod4(file, file_len);
+// WHETHER A REQUEST SHOULD BE MADE OF s NOW. ONCE AN OPEN CIRCUIT'S BACKOFF
+// HAS PASSED, ONE REQUEST IS LET THROUGH AS A PROBE AND THE REST ARE HELD
+// BACK FOR ANOTHER BACKOFF, SO A PROBE THAT NEVER REPORTS BACK CAN'T SHUT
+// THE SERVER OUT FOR GOOD.
+int server_usable(struct server *s) {
+    int usable = 1;
+    pthread_mutex_lock(&s->lock);
+    if (s->failures >= CIRCUIT_FAILURES) {
+        u64 now = now_ms();
+        if (now < s->open_until) {
+            usable = 0;
+        } else {
+            TRACE("probing %s:%s", s->ip, s->port);
+            s->open_until = now + s->backoff_ms;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return usable;
+}
 
-    for (usize i = 0; i < 4; ++i) {
-        usize dfsn = (i + mod) % 4;
-        struct sockaddr *addr = (struct sockaddr *) &dfs[dfsn].addr;
-        usize addrlen = sizeof(struct sockaddr_in);
+// RECORDS A FULL EXCHANGE WITH s, AND HOW LONG ITS ROUND TRIP TOOK IF
+// rtt_us ISN'T 0. DATA TRANSFERS PASS 0: THEIR TIME DEPENDS ON THEIR SIZE.
+void note_success(struct server *s, u64 rtt_us) {
+    pthread_mutex_lock(&s->lock);
+    if (s->failures >= CIRCUIT_FAILURES) {
+        TRACE("%s:%s is back", s->ip, s->port);
+    }
+    s->failures = 0;
+    if (rtt_us) {
+        s->latency_us = s->latency_us
+            ? (s->latency_us * (LATENCY_WEIGHT - 1) + rtt_us) / LATENCY_WEIGHT
+            : rtt_us;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
 
-        int fd = connect_with_timeout(&dfs[dfsn].addr, CONNECT_TIMEOUT_MS);
-        if (fd < 0) {
-            goto next_server;
+// RECORDS A CONNECT OR EXCHANGE WITH s THAT FAILED OR TIMED OUT
+void note_failure(struct server *s) {
+    pthread_mutex_lock(&s->lock);
+    s->failures += 1;
+    if (s->failures >= CIRCUIT_FAILURES) {
+        if (s->failures == CIRCUIT_FAILURES) {
+            s->backoff_ms = BACKOFF_MIN_MS;
+        } else if (s->backoff_ms < BACKOFF_MAX_MS / 2) {
+            s->backoff_ms *= 2;
+        } else {
+            s->backoff_ms = BACKOFF_MAX_MS;
         }
+        s->open_until = now_ms() + s->backoff_ms;
+        TRACE("%s:%s circuit open for %llu ms", s->ip, s->port, (unsigned long long)s->backoff_ms);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
 
-        struct request r;
-        struct response res;
-
-        TRACE("sending part %d to dfs[%d]", i, dfsn);
-        memset(&r, 0, sizeof(struct request));
-        r.username = strdup(username);
-        r.password = strdup(password);
-        r.type = PUT;
-        // MAKE .filename.txt.x pathname
-        r.put.path = make_part_path(path, i);
-        make_part(file, file_len, &r.put.file.buf, &r.put.file.len, i);
+// WHETHER b IS CLEARLY THE BETTER SERVER TO ASK THAN a: a'S CIRCUIT IS OPEN
+// AND b'S ISN'T, OR a HAS BEEN ANSWERING LATENCY_SKEW TIMES SLOWER
+int healthier(struct server *b, struct server *a) {
+    pthread_mutex_lock(&a->lock);
+    int a_open = a->failures >= CIRCUIT_FAILURES;
+    u64 a_latency = a->latency_us;
+    pthread_mutex_unlock(&a->lock);
+    pthread_mutex_lock(&b->lock);
+    int b_open = b->failures >= CIRCUIT_FAILURES;
+    u64 b_latency = b->latency_us;
+    pthread_mutex_unlock(&b->lock);
+    if (a_open != b_open) {
+        return a_open;
+    }
+    return b_latency && a_latency > LATENCY_SKEW * b_latency;
+}
 
-        int err = send_put_request(fd, &r);
-        if (err != 0) {
-            TRACE("error sending part %d to dfs[%d]", i, dfsn);
-        }
-        free(r.put.path);
-        free(r.put.file.buf);
-        free(r.username);
-        free(r.password);
-
-        memset(&res, 0, sizeof(res));
-        set_nonblocking(fd, 0);
-        err = recv_put_response(fd, &res);
-        set_nonblocking(fd, 1);
-        switch (res.status) {
-         case SUCCESS:
-            println("success putting part %d to dfs[%d]", i, dfsn);
-            break;
+// CONNECTIONS ARE ONLY POOLED BETWEEN EXCHANGES, WITH NOTHING LEFT TO READ,
+// SO ONE THAT POLLS READABLE HAS BEEN CLOSED BY ITS SERVER
+int connection_alive(int fd) {
+    struct pollfd readable = {
+        .fd = fd,
+        .events = POLLIN,
+        .revents = 0,
+    };
+    return poll(&readable, 1, 0) == 0;
+}
 
-        case INVALID_PATH:
-            println("invalid put path \"%s\", dfs[%d]", path, dfsn);
+// RETURNS AN IDLE CONNECTION TO s THAT IS STILL OPEN, OR -1 IF THERE IS NONE
+int take_idle(struct server *s) {
+    int fd = -1;
+    pthread_mutex_lock(&s->lock);
+    while (fd < 0 && s->num_idle > 0) {
+        fd = s->idle[--s->num_idle];
+        if (!connection_alive(fd)) {
+            TRACE("dropping closed connection to %s:%s", s->ip, s->port);
             close(fd);
-            return -1;
-            break;
+            fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return fd;
+}
 
-        case INVALID_IDENTITY:
-            println("invalid username/password: %s:%s", username, password);
-            close(fd);
-            return -1;
-            break;
+// REUSES AN IDLE CONNECTION TO s IF THERE IS ONE, OR OPENS A NEW ONE.
+// FAILS STRAIGHT AWAY WHILE s'S CIRCUIT IS OPEN.
+int take_connection(struct server *s) {
+    if (!server_usable(s)) {
+        TRACE("skipping %s:%s, circuit open", s->ip, s->port);
+        return -1;
+    }
+    int fd = take_idle(s);
+    if (fd >= 0) {
+        return fd;
+    }
+    fd = connect_with_timeout(&s->addr, CONNECT_TIMEOUT_MS);
+    if (fd < 0) {
+        note_failure(s);
+    }
+    return fd;
+}
 
-        default:
-            panic("unexpected response status %d", res.status);
-        }
+// HANDS BACK A CONNECTION WHOSE LAST RESPONSE HAS BEEN READ IN FULL. ONE
+// LEFT PART WAY THROUGH AN EXCHANGE MUST BE CLOSED INSTEAD.
+void give_connection(struct server *s, int fd) {
+    pthread_mutex_lock(&s->lock);
+    if (s->num_idle < POOL_MAX) {
+        s->idle[s->num_idle++] = fd;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
 
-        TRACE("sending part %d to dfs[%d]", (i + 1) % 4, dfsn);
-        memset(&r, 0, sizeof(struct request));
-        r.username = strdup(username);
-        r.password = strdup(password);
-        r.type = PUT;
-        // MAKE .filename.txt.x pathname
-        r.put.path = make_part_path(path, (i + 1) % 4);
-        make_part(file, file_len, &r.put.file.buf, &r.put.file.len, (i + 1) % 4);
+void drop_connections(struct server *s) {
+    for (int i = 0; i < s->num_idle; ++i) {
+        close(s->idle[i]);
+    }
+    s->num_idle = 0;
+}
 
-        err = send_put_request(fd, &r);
-        if (err != 0) {
-            TRACE("error sending part %d to dfs[%d]", (i + 1) % 4, dfsn);
-        }
-        free(r.username);
-        free(r.password);
-        free(r.put.path);
-        free(r.put.file.buf);
-
-        memset(&res, 0, sizeof(res));
-        set_nonblocking(fd, 0);
-        err = recv_put_response(fd, &res);
-        set_nonblocking(fd, 1);
-        switch (res.status) {
-         case SUCCESS:
-            println("success putting part %d to dfs[%d]", (i + 1) % 4, dfsn);
-            break;
+// BYTES OF THE SOURCE MASKED, CHECKSUMMED, ENCODED AND SENT AT A TIME. A
+// MULTIPLE OF CODEC_CHUNK, SO ENCODING A PART A SLICE AT A TIME GIVES THE
+// SAME CHUNKS AS ENCODING IT WHOLE.
+#define PUT_SLICE (16 * CODEC_CHUNK)
+
+// ONE PART OF A FILE BEING PUT, STREAMED STRAIGHT OUT OF THE MAPPED SOURCE.
+// len IS ITS LENGTH ENCODED WITH codec, OR raw_len. checksum COVERS THE
+// MASKED PLAIN BYTES, SO IT HOLDS HOWEVER THE PART IS SENT.
+struct put_part {
+    byte const *src;
+    usize raw_len;
+    usize len;
+    u64 codec;
+    u64 checksum;
+};
 
-        case INVALID_PATH:
-            println("invalid put path \"%s\", dfs[%d]", path, dfsn);
-            close(fd);
-            return -1;
-            break;
+// BUFFERS A PART IS STREAMED THROUGH, THE SAME SIZE HOWEVER BIG THE FILE
+struct put_slices {
+    byte *masked;
+    byte *encoded;
+};
 
-        case INVALID_IDENTITY:
-            println("invalid username/password: %s:%s", username, password);
-            close(fd);
-            return -1;
-            break;
+// MASKS THE SLICE OF p STARTING done BYTES IN INTO s, AND ENCODES IT TOO IF
+// encoded IS SET. RETURNS THE BYTES TO SEND AND SETS *slice_len TO HOW MANY
+// OF THE PART'S PLAIN BYTES THEY COVER.
+byte const *next_slice(struct put_part const *p, struct put_slices *s, usize done, byte mask, int encoded, usize *slice_len, usize *len) {
+    usize n = p->raw_len - done < PUT_SLICE ? p->raw_len - done : PUT_SLICE;
+    xor_copy(s->masked, &p->src[done], n, mask);
+    release_mapped(p->src, done, done + n);
+    *slice_len = n;
+    if (!encoded) {
+        *len = n;
+        return s->masked;
+    }
+    *len = compress_part(s->masked, n, s->encoded);
+    return s->encoded;
+}
+
+// WORKS OUT HOW LONG p IS ONCE ENCODED WITH codec. A PUT CARRIES ITS LENGTH
+// AHEAD OF ITS BODY, AND HOLDING THE ENCODED PART TO MEASURE IT WOULD TAKE AS
+// MUCH MEMORY AS THE PART, SO IT IS ENCODED ONCE HERE JUST TO COUNT AND AGAIN
+// AS IT IS SENT.
+void measure_part(struct put_part *p, struct put_slices *s, byte mask, u64 codec) {
+    p->codec = codec;
+    p->len = p->raw_len;
+    if (codec == CODEC_NONE) {
+        return;
+    }
+    p->len = 0;
+    for (usize done = 0, n, len; done < p->raw_len; done += n) {
+        next_slice(p, s, done, mask, 1, &n, &len);
+        p->len += len;
+    }
+}
+
+// SENDS PART partn OF path TO EVERY CONNECTED fd AT ONCE, ENCODED IF encoded
+// IS SET, WITHOUT WAITING FOR THE ANSWERS. EACH SLICE IS MASKED AND ENCODED
+// ONCE FOR ALL OF THEM. A CONNECTION THAT FAILS IS CLOSED AND SET TO -1.
+void send_part(int fd[2],
+               char const *username,
+               char const *password,
+               char const *path,
+               int partn,
+               struct put_part const *part,
+               struct put_slices *s,
+               byte mask,
+               int encoded)
+{
+    struct request r = {0};
+    r.username = (char *)username;
+    r.password = (char *)password;
+    r.type = PUT;
+    // MAKE .filename.txt.x pathname
+    r.put.path = make_part_path(path, partn);
+    r.put.file.len = encoded ? part->len : part->raw_len;
+    r.put.codec = encoded ? part->codec : CODEC_NONE;
+    r.put.checksum = part->checksum;
+    r.put.plain_len = r.put.codec != CODEC_NONE ? part->raw_len : 0;
+    encoded = r.put.codec != CODEC_NONE;
+
+    TRACE("sending part %d (%zu bytes, codec %llu)", partn, r.put.file.len, (unsigned long long)r.put.codec);
+    for (int k = 0; k < 2; ++k) {
+        if (fd[k] >= 0 && send_put_request(fd[k], &r) != 0) {
+            TRACE("error sending part %d", partn);
+            close(fd[k]);
+            fd[k] = -1;
+        }
+    }
+    for (usize done = 0, n, len; done < part->raw_len && (fd[0] >= 0 || fd[1] >= 0); done += n) {
+        byte const *slice = next_slice(part, s, done, mask, encoded, &n, &len);
+        for (int k = 0; k < 2; ++k) {
+            if (fd[k] >= 0 && send_all(fd[k], slice, len, 0) != 0) {
+                TRACE("error sending part %d", partn);
+                close(fd[k]);
+                fd[k] = -1;
+            }
+        }
+    }
+    free(r.put.path);
+}
+
+// RETURNS THE STATUS OF THE NEXT PUT ANSWERED ON fd, OR -1 IF NONE CAME
+int recv_put_status(int fd) {
+    struct response res = {0};
+    int status = recv_put_response(fd, &res) == 0 ? res.status : -1;
+    drop_response(&res);
+    return status;
+}
 
-        default:
-            panic("unexpected response status %d", res.status);
+// ONE PART OF A PUT AND THE TWO SERVERS IT GOES TO, dfs[(n + mod) % 4] AND
+// THE ONE BEFORE IT. EVERY PART GETS A THREAD OF ITS OWN, SO ALL FOUR ARE
+// MEASURED AND STREAMED AT ONCE, AND EVERY SERVER TAKES ITS TWO PARTS ON
+// TWO CONNECTIONS SIDE BY SIDE.
+struct put_job {
+    char const *username;
+    char const *password;
+    char const *path;
+    struct server *servers[2];
+    int n;
+    byte mask;
+    u64 codec;
+    struct put_part part;
+    int status[2];
+    pthread_t thread;
+};
+
+// A PART A SERVER CAN'T STORE ENCODED IS RESENT TO IT PLAIN
+void *run_put_job(void *arg) {
+    struct put_job *j = arg;
+    struct put_slices s = {
+        .masked = malloc(PUT_SLICE),
+        .encoded = j->codec != CODEC_NONE ? malloc(compressed_bound(PUT_SLICE)) : NULL,
+    };
+    int fd[2];
+    for (int k = 0; k < 2; ++k) {
+        j->status[k] = -1;
+        fd[k] = take_connection(j->servers[k]);
+        if (fd[k] < 0) {
+            TRACE("unable to connect to %s:%s", j->servers[k]->ip, j->servers[k]->port);
         }
+    }
 
-next_server:
-        close(fd);
+    if (fd[0] >= 0 || fd[1] >= 0) {
+        measure_part(&j->part, &s, j->mask, j->codec);
+        send_part(fd, j->username, j->password, j->path, j->n, &j->part, &s, j->mask, 1);
     }
-    
-    return 0;
+    for (int k = 0; k < 2; ++k) {
+        if (fd[k] >= 0) {
+            j->status[k] = recv_put_status(fd[k]);
+        }
+        if (j->status[k] == UNSUPPORTED_CODEC) {
+            TRACE("%s:%s can't store compressed parts, resending plain", j->servers[k]->ip, j->servers[k]->port);
+            int plain[2] = { k == 0 ? fd[0] : -1, k == 1 ? fd[1] : -1 };
+            send_part(plain, j->username, j->password, j->path, j->n, &j->part, &s, j->mask, 0);
+            fd[k] = plain[k];
+            j->status[k] = fd[k] >= 0 ? recv_put_status(fd[k]) : -1;
+        }
+        if (fd[k] < 0) {
+            continue;
+        }
+        if (j->status[k] != -1) {
+            note_success(j->servers[k], 0);
+            give_connection(j->servers[k], fd[k]);
+        } else {
+            note_failure(j->servers[k]);
+            close(fd[k]);
+        }
+    }
+    free(s.masked);
+    free(s.encoded);
+    return NULL;
 }
 
-int get_file(char const *username,
+// PUTS THE LOCAL FILE source AS path WITHOUT EVER HOLDING MORE THAN A FEW
+// SLICES OF IT IN MEMORY. WHERE THE PARTS GO DEPENDS ON THE MD5 OF THE WHOLE
+// MASKED FILE, SO ONE PASS OVER IT WORKS THAT OUT, ALONG WITH EVERY PART'S
+// CHECKSUM, BEFORE ANYTHING IS SENT. THEN EVERY PART IS STREAMED TO BOTH OF
+// ITS SERVERS, ALL FOUR PARTS AT ONCE, SO A PUT TAKES ABOUT AS LONG AS ITS
+// SLOWEST SERVER. WITH codec SET, PARTS ARE SENT AND STORED COMPRESSED,
+// UNLESS A SERVER CAN'T RECORD THE CODEC, IN WHICH CASE IT GETS THE PLAIN
+// PART INSTEAD. RESULTS ARE PRINTED IN SERVER ORDER ONCE EVERY JOB HAS
+// FINISHED. THE SOURCE MUSTN'T BE TRUNCATED WHILE IT IS BEING PUT.
+int put_file(char const *username,
              char const *password,
              struct server dfs[4],
-             char const *path)
+             char const *path,
+             char const *source,
+             u64 codec)
 {
-    byte *part[4];
-    usize partlen[4];
-    memset(part, 0, sizeof(part));
-    memset(partlen, 0, sizeof(partlen));
+    byte *file;
+    usize file_len;
+    if (map_file(source, &file, &file_len) != 0) {
+        println("unable to read \"%s\": %s", source, system_error());
+        return -1;
+    }
+    // ENCRYPT FILE
+    byte mask = make_mask(password);
+    usize q = file_len / 4;
+    struct put_job jobs[4];
+    u32 crc[4] = {0};
+    int err = 0;
+
+    EVP_MD_CTX *md5 = start_md5_mod4();
+    byte *masked = malloc(PUT_SLICE);
+    for (usize done = 0, n; done < file_len; done += n) {
+        n = file_len - done < PUT_SLICE ? file_len - done : PUT_SLICE;
+        xor_copy(masked, &file[done], n, mask);
+        release_mapped(file, done, done + n);
+        update_md5_mod4(md5, masked, n);
+        // A SLICE CAN STRADDLE THE END OF A PART. PART partn STARTS AT
+        // partn * q, AND THE LAST ONE RUNS TO THE END OF THE FILE.
+        for (usize at = 0; at < n; ) {
+            usize pos = done + at;
+            int partn = q == 0 || pos / q > 3 ? 3 : pos / q;
+            usize part_end = partn < 3 ? (partn + 1) * q : file_len;
+            usize take = part_end - pos < n - at ? part_end - pos : n - at;
+            crc[partn] = crc32c(crc[partn], &masked[at], take);
+            at += take;
+        }
+    }
+    free(masked);
+    int mod = finish_md5_mod4(md5);
+
+    for (int n = 0; n < 4; ++n) {
+        struct put_job *j = &jobs[n];
+        j->username = username;
+        j->password = password;
+        j->path = path;
+        // dfs[(i + mod) % 4] HOLDS PARTS i AND i + 1
+        j->servers[0] = &dfs[(n + mod) % 4];
+        j->servers[1] = &dfs[(n + mod + 3) % 4];
+        j->n = n;
+        j->mask = mask;
+        j->codec = codec;
+        j->part.src = &file[q * n];
+        j->part.raw_len = part_size(file_len, n);
+        j->part.checksum = CHECKSUM_SET | crc[n];
+        if (pthread_create(&j->thread, NULL, run_put_job, j) != 0) {
+            panic("unable to start put thread: %s", system_error());
+        }
+    }
+    for (int n = 0; n < 4; ++n) {
+        pthread_join(jobs[n].thread, NULL);
+    }
+    unmap_file(file, file_len);
+
+    for (int dfsn = 0; dfsn < 4 && err == 0; ++dfsn) {
+        for (int k = 0; k < 2 && err == 0; ++k) {
+            // dfs[dfsn] HOLDS PART (dfsn - mod) % 4 AS ITS servers[0] AND THE
+            // ONE AFTER IT AS ITS servers[1]
+            int partn = (dfsn - mod + 4 + k) % 4;
+            int status = jobs[partn].status[k];
+            if (status == -1) {
+                TRACE("no put response from dfs[%d] for part %d", dfsn, partn);
+                continue;
+            }
+            switch (status) {
+            case SUCCESS:
+                println("success putting part %d to dfs[%d]", partn, dfsn);
+                break;
 
-    for (int i = 0; i < 2; ++i) {
-        int fd[2];
+            case INVALID_PATH:
+                println("invalid put path \"%s\", dfs[%d]", path, dfsn);
+                err = -1;
+                break;
+
+            case INVALID_IDENTITY:
+                println("invalid username/password: %s:%s", username, password);
+                err = -1;
+                break;
 
-        fd[0] = connect_with_timeout(&dfs[0 + i].addr, CONNECT_TIMEOUT_MS);
-        if (fd[0] < 0) {
-            if (fd[0] == CONNECT_TIMEOUT) {
-                println("timeout connecting to dfs[%d]", 0 + i);
+            default:
+                // ONLY THIS SERVER'S COPY OF THE PART IS LOST; THE OTHER
+                // HOLDER MAY STILL HAVE IT
+                println("failed putting part %d to dfs[%d]: %s", partn, dfsn, status_to_string(status));
+                break;
             }
-            continue;
         }
+    }
+    return err;
+}
 
-        fd[1] = connect_with_timeout(&dfs[2 + i].addr, CONNECT_TIMEOUT_MS);
-        if (fd[1] < 0) {
-            if (fd[1] == CONNECT_TIMEOUT) {
-                println("timeout connecting to dfs[%d]", 2 + i);
-            }
-            close(fd[0]);
+// WHERE EACH SERVER IS IN A FAN-OUT
+#define FANOUT_IDLE         0
+#define FANOUT_CONNECTING   1
+#define FANOUT_WAITING      2
+// ONCE TWO SERVERS THAT HOLD EVERY PART BETWEEN THEM HAVE ANSWERED, THE REST
+// GET AS LONG AGAIN AS THAT TOOK, BUT AT LEAST FANOUT_GRACE_MIN_MS, BEFORE
+// THEY ARE GIVEN UP ON: ANYTHING THEY HOLD IS ALREADY ACCOUNTED FOR
+#define FANOUT_GRACE_MIN_MS 20
+
+// ONE REQUEST MADE OF EVERY SERVER AT ONCE. ALL FOUR ARE CONNECTED TO
+// TOGETHER AND ANSWERS ARE HANDLED IN THE ORDER THEY ARRIVE, SO A DEAD
+// SERVER COSTS NOTHING WHEN IT REFUSES AND AT MOST ONE CONNECT_TIMEOUT_MS,
+// SHARED BY ALL, WHEN IT DOESN'T.
+struct fanout {
+    struct server *dfs;
+    int fd[4];
+    byte state[4];
+    // BIT dfsn IS SET ONCE dfs[dfsn] HAS BEEN FINISHED WITH AN ANSWER
+    byte answered;
+    u64 started;
+    u64 started_us;
+    // HOW LONG EACH SERVER TOOK TO START ANSWERING, CONNECT INCLUDED
+    u64 rtt_us[4];
+    u64 connect_deadline;
+    // 0 UNTIL EITHER THE CALLER'S TIMEOUT OR THE GRACE PERIOD APPLIES
+    u64 deadline;
+};
+
+void start_fanout(struct fanout *f, struct server dfs[4], int timeout_ms) {
+    memset(f, 0, sizeof(struct fanout));
+    f->dfs = dfs;
+    f->started = now_ms();
+    f->started_us = now_us();
+    f->connect_deadline = f->started + CONNECT_TIMEOUT_MS;
+    if (timeout_ms > 0) {
+        f->deadline = f->started + timeout_ms;
+    }
+    for (int dfsn = 0; dfsn < 4; ++dfsn) {
+        f->fd[dfsn] = -1;
+        if (!server_usable(&dfs[dfsn])) {
+            TRACE("skipping dfs[%d], circuit open", dfsn);
             continue;
         }
+        // A POOLED CONNECTION POLLS WRITEABLE STRAIGHT AWAY, JUST LIKE A
+        // CONNECT THAT HAS FINISHED
+        f->fd[dfsn] = take_idle(&dfs[dfsn]);
+        if (f->fd[dfsn] < 0) {
+            f->fd[dfsn] = start_connect(&dfs[dfsn].addr);
+        }
+        if (f->fd[dfsn] < 0) {
+            TRACE("unable to connect to dfs[%d]", dfsn);
+            note_failure(&dfs[dfsn]);
+            continue;
+        }
+        f->state[dfsn] = FANOUT_CONNECTING;
+    }
+}
 
-        int parts_collected = 0;
-        for (int j = 0; j < 2; ++j) {
-            int conn = fd[j];
-            for (int partn = 0; partn < 4; ++partn) {
-                char *partn_path = make_part_path(path, partn);
-                int err = send_get_request(conn, username, password, partn_path);
-                if (err != 0) {
-                    TRACE("send_get_request: %s", system_error());
-                    goto finish;
-                }
-                free(partn_path);
-
-                struct response res = {0};
-                set_nonblocking(conn, 0);
-                err = recv_get_response(conn, &res);
-                set_nonblocking(conn, 1);
-                if (err != 0) {
-                    TRACE("recv_get_response: %s", system_error());
-                    goto finish;
-                }
+// DONE WITH dfs[dfsn]. A SERVER THAT answered IS KEPT CONNECTED FOR THE
+// NEXT COMMAND AND ITS ROUND TRIP COUNTED TOWARDS ITS LATENCY; ONE THAT
+// DIDN'T COUNTS AS A FAILURE.
+void finish_server(struct fanout *f, int dfsn, int answered) {
+    if (f->state[dfsn] == FANOUT_IDLE) {
+        return;
+    }
+    if (answered) {
+        note_success(&f->dfs[dfsn], f->rtt_us[dfsn]);
+        give_connection(&f->dfs[dfsn], f->fd[dfsn]);
+    } else {
+        note_failure(&f->dfs[dfsn]);
+        close(f->fd[dfsn]);
+    }
+    f->fd[dfsn] = -1;
+    f->state[dfsn] = FANOUT_IDLE;
+    if (!answered) {
+        return;
+    }
+    f->answered |= 1 << dfsn;
+    // dfs[0] AND dfs[2] HOLD ALL FOUR PARTS BETWEEN THEM, AS DO dfs[1] AND dfs[3]
+    if ((f->answered & 0x5) == 0x5 || (f->answered & 0xa) == 0xa) {
+        u64 now = now_ms();
+        u64 grace = now - f->started > FANOUT_GRACE_MIN_MS ? now - f->started : FANOUT_GRACE_MIN_MS;
+        if (!f->deadline || now + grace < f->deadline) {
+            f->deadline = now + grace;
+        }
+    }
+}
 
-                if (res.status == SUCCESS) {
-                    parts_collected += 1;
-                    assert(part[partn] == NULL);
-                    assert(partlen[partn] == 0);
-                    part[partn] = res.get.file.buf;
-                    partlen[partn] = res.get.file.len;
+// WAITS FOR THE NEXT SERVER THAT NEEDS ATTENTION AND RETURNS ITS INDEX, WITH
+// *connected SET IF IT HAS JUST CONNECTED AND NEEDS ITS REQUEST SENT, OR
+// CLEAR IF ITS ANSWER IS ARRIVING. RETURNS -1 ONCE EVERY SERVER IS FINISHED
+// OR OUT OF TIME.
+int next_server(struct fanout *f, int *connected) {
+    for (;;) {
+        struct pollfd ready[4];
+        int waiting = 0;
+        int timeout = -1;
+        u64 now = now_ms();
+        for (int dfsn = 0; dfsn < 4; ++dfsn) {
+            // poll SKIPS NEGATIVE FDS
+            ready[dfsn].fd = -1;
+            ready[dfsn].revents = 0;
+            if (f->state[dfsn] == FANOUT_IDLE) {
+                continue;
+            }
+            u64 deadline = f->deadline;
+            if (f->state[dfsn] == FANOUT_CONNECTING && (!deadline || f->connect_deadline < deadline)) {
+                deadline = f->connect_deadline;
+            }
+            if (deadline && now >= deadline) {
+                TRACE("gave up waiting for dfs[%d]", dfsn);
+                finish_server(f, dfsn, 0);
+                continue;
+            }
+            if (deadline && (timeout < 0 || deadline - now < (u64)timeout)) {
+                timeout = deadline - now;
+            }
+            ready[dfsn].fd = f->fd[dfsn];
+            ready[dfsn].events = f->state[dfsn] == FANOUT_CONNECTING ? POLLOUT : POLLIN;
+            waiting += 1;
+        }
+        if (waiting == 0) {
+            return -1;
+        }
+        if (poll(ready, 4, timeout) < 0 && errno != EINTR) {
+            TRACE("poll: %s", system_error());
+            return -1;
+        }
+        for (int dfsn = 0; dfsn < 4; ++dfsn) {
+            if (ready[dfsn].fd < 0 || !ready[dfsn].revents) {
+                continue;
+            }
+            if (f->state[dfsn] == FANOUT_WAITING) {
+                if (!f->rtt_us[dfsn]) {
+                    f->rtt_us[dfsn] = now_us() - f->started_us + 1;
                 }
+                *connected = 0;
+                return dfsn;
             }
+            if (finish_connect(f->fd[dfsn]) != 0) {
+                TRACE("unable to connect to dfs[%d]", dfsn);
+                finish_server(f, dfsn, 0);
+                continue;
+            }
+            f->state[dfsn] = FANOUT_WAITING;
+            *connected = 1;
+            return dfsn;
+        }
+    }
+}
+
+// CLOSES WHATEVER IS STILL GOING, WHICH IS THE CALLER GIVING UP, NOT THE
+// SERVERS FAILING
+void drop_fanout(struct fanout *f) {
+    for (int dfsn = 0; dfsn < 4; ++dfsn) {
+        if (f->state[dfsn] != FANOUT_IDLE) {
+            close(f->fd[dfsn]);
+            f->fd[dfsn] = -1;
+            f->state[dfsn] = FANOUT_IDLE;
+        }
+    }
+}
+
+// status OF A PART ON A SERVER THAT DIDN'T ANSWER
+#define PART_UNKNOWN 0xff
+
+// LONGEST A STAT MAY TAKE TO BE ANSWERED BEFORE ITS SERVER IS TREATED AS DOWN
+#define STAT_TIMEOUT_MS 1000
+
+// ASKS EVERY SERVER ABOUT ALL FOUR PARTS OF path AT ONCE, SO THE WHOLE FILE
+// TAKES ONE ROUND TRIP AND NO DATA. stats[dfsn][partn] IS WHAT dfs[dfsn]
+// HOLDS OF PART partn. A SERVER THAT HASN'T ANSWERED WITHIN STAT_TIMEOUT_MS
+// IS LEFT OUT.
+void stat_parts(char const *username,
+                char const *password,
+                struct server dfs[4],
+                char const *path,
+                struct part_stat stats[4][4])
+{
+    char *part_paths[4];
+    for (int partn = 0; partn < 4; ++partn) {
+        part_paths[partn] = make_part_path(path, partn);
+    }
+    for (int dfsn = 0; dfsn < 4; ++dfsn) {
+        for (int partn = 0; partn < 4; ++partn) {
+            memset(&stats[dfsn][partn], 0, sizeof(struct part_stat));
+            stats[dfsn][partn].status = PART_UNKNOWN;
         }
-        if (parts_collected < 4) {
-            close(fd[0]);
-            close(fd[1]);
+    }
+
+    struct fanout f;
+    start_fanout(&f, dfs, STAT_TIMEOUT_MS);
+    int connected;
+    int dfsn;
+    while ((dfsn = next_server(&f, &connected)) >= 0) {
+        if (connected) {
+            send_stat_request(f.fd[dfsn], username, password, part_paths, 4);
             continue;
         }
+        struct response res = {0};
+        int answered = 0;
+        if (recv_stat_response(f.fd[dfsn], &res) != 0) {
+            TRACE("no stat response from dfs[%d]", dfsn);
+        } else {
+            if (res.status != SUCCESS) {
+                println("dfs[%d]: %s", dfsn, status_to_string(res.status));
+            }
+            for (usize partn = 0; partn < 4 && partn < res.stat.count; ++partn) {
+                stats[dfsn][partn] = res.stat.parts[partn];
+            }
+            answered = 1;
+        }
+        drop_response(&res);
+        finish_server(&f, dfsn, answered);
+    }
+    drop_fanout(&f);
+    for (int partn = 0; partn < 4; ++partn) {
+        free(part_paths[partn]);
+    }
+}
 
-finish:
-        close(fd[0]);
-        close(fd[1]);
-        break;
+// A PART STILL RUNNING THIS MANY TIMES LONGER THAN THE FIRST PART TO
+// FINISH TOOK IS ASKED FOR FROM ITS OTHER REPLICA TOO, BUT NEVER BEFORE
+// HEDGE_MIN_MS. PARTS ARE THE SAME SIZE, SO ONE THAT FALLS THIS FAR BEHIND
+// IS ON A SLOW OR STUCK SERVER.
+#define HEDGE_FACTOR    2
+#define HEDGE_MIN_MS    50
+// LONGEST THE PLANNER SLEEPS BEFORE LOOKING AGAIN
+#define PLAN_TICK_MS    10
+
+// ONE REQUEST FOR ONE PART FROM ONE SERVER, ON A CONNECTION AND THREAD OF
+// ITS OWN. fd, done AND cancelled ARE GUARDED BY THE PLAN'S lock, SO THE
+// PLANNER CAN SHUT A LOSING REQUEST DOWN WHILE ITS THREAD IS BLOCKED ON IT.
+// THE PART IS WRITTEN INTO THE OUTPUT FILE THROUGH sink, EITHER IN PLACE OR,
+// WITH scratch SET, INTO A SLOT PAST THE END OF THE FILE.
+struct fetch {
+    struct get_plan *plan;
+    int partn;
+    int dfsn;
+    int fd;
+    int done;
+    int cancelled;
+    int seen;
+    int scratch;
+    struct body_sink sink;
+    struct response res;
+    pthread_t thread;
+};
+
+// WHERE EACH PART OF A FILE CAN BE READ FROM, AND THE REQUESTS FOR IT SO
+// FAR. holders[partn] LISTS THE SERVERS STAT FOUND IT ON, BEST FIRST, AND
+// next[partn] THE FIRST ONE NOT YET ASKED. EVERY PART IS ASKED OF AT MOST
+// EACH OF ITS HOLDERS ONCE. PART partn HAS part_len[partn] PLAIN BYTES, OF
+// WHICH len[partn] FROM from[partn] ON ARE WANTED, AND THEY GO AT at[partn]
+// IN THE FILE out, WHICH IS out_len BYTES LONG. A ranged PLAN ASKS FOR THOSE
+// BYTES WITH GET_RANGE AND SKIPS PARTS IT WANTS NOTHING FROM. PAST THE END OF
+// out ARE num_scratch SLOTS OF scratch_len BYTES FOR HEDGES TO LAND IN.
+struct get_plan {
+    char const *username;
+    char const *password;
+    struct server *dfs;
+    char *part_paths[4];
+    int out;
+    byte mask;
+    int ranged;
+    int sized[4];
+    u64 part_len[4];
+    u64 from[4];
+    u64 len[4];
+    u64 at[4];
+    u64 out_len;
+    u64 scratch_len;
+    int num_scratch;
+    int holders[4][4];
+    int num_holders[4];
+    int next[4];
+    int running[4];
+    u64 started[4];
+    struct fetch fetches[16];
+    int num_fetches;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+void *run_fetch(void *arg) {
+    struct fetch *f = arg;
+    struct get_plan *p = f->plan;
+    int fd = take_connection(&p->dfs[f->dfsn]);
+
+    pthread_mutex_lock(&p->lock);
+    if (fd >= 0 && f->cancelled) {
+        close(fd);
+        fd = -1;
     }
+    f->fd = fd;
+    pthread_mutex_unlock(&p->lock);
 
-    int incomplete = 0;
-    for (int i = 0; i < 4; ++i) {
-        if (part[i] == NULL) {
-            incomplete = 1;
-            break;
+    int err = -1;
+    if (fd >= 0) {
+        struct request r;
+        if (p->ranged) {
+            init_path_request(&r, GET_RANGE, p->username, p->password, p->part_paths[f->partn]);
+            r.get_range.offset = p->from[f->partn];
+            r.get_range.length = p->len[f->partn];
+            if (send_request(fd, &r) == 0) {
+                err = recv_get_range_response_to(fd, &f->sink, &f->res);
+            }
+        } else {
+            init_path_request(&r, GET, p->username, p->password, p->part_paths[f->partn]);
+            r.get.accept = CODEC_BIT(CODEC_ZLIB);
+            r.get.flags = GET_CHECKSUMS;
+            if (send_request(fd, &r) == 0) {
+                err = recv_get_response_to(fd, &f->sink, &f->res);
+            }
         }
     }
 
-    if (incomplete) {
-        println("failed to get \"%s\": file incomplete", path);
-        for (int i = 0; i < 4; ++i) {
-            free(part[i]);
-            part[i] = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (f->fd >= 0) {
+        // A CANCELLED REQUEST HAS BEEN SHUT DOWN PART WAY THROUGH, WHICH
+        // SAYS NOTHING ABOUT ITS SERVER
+        if (err == 0 && !f->cancelled) {
+            note_success(&p->dfs[f->dfsn], 0);
+            give_connection(&p->dfs[f->dfsn], f->fd);
+        } else {
+            if (!f->cancelled) {
+                note_failure(&p->dfs[f->dfsn]);
+            }
+            close(f->fd);
         }
+        f->fd = -1;
+    }
+    if (err != 0 && f->res.status == SUCCESS) {
+        f->res.status = fd >= 0 ? FILE_NOT_FOUND : PART_UNKNOWN;
+    }
+    f->done = 1;
+    pthread_cond_signal(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// ASKS THE NEXT HOLDER OF PART partn FOR IT. RETURNS -1 IF EVERY HOLDER HAS
+// BEEN ASKED ALREADY. CALLED WITH THE LOCK HELD.
+int start_fetch(struct get_plan *p, int partn) {
+    if (p->next[partn] == p->num_holders[partn]) {
         return -1;
     }
+    struct fetch *f = &p->fetches[p->num_fetches];
+    memset(f, 0, sizeof(struct fetch));
+    f->plan = p;
+    f->partn = partn;
+    f->dfsn = p->holders[partn][p->next[partn]];
+    f->fd = -1;
+    // ONLY A PART'S SOLE RUNNING REQUEST WRITES IT IN PLACE. A HEDGE WRITES
+    // TO A SCRATCH SLOT, COPIED IN ONLY IF IT WINS, SO TWO COPIES NEVER WRITE
+    // THE SAME BYTES AT ONCE AND A LOSING HEDGE NEVER TOUCHES THE FILE. A
+    // COPY IS ONLY CHECKED ONCE ALL OF IT HAS ARRIVED, SO ONE WRITTEN IN
+    // PLACE THAT TURNS OUT CORRUPT IS ALREADY IN THE FILE UNTIL ANOTHER COPY
+    // REPLACES IT.
+    f->sink.fd = p->out;
+    f->sink.len = p->len[partn];
+    f->sink.mask = p->mask;
+    if (p->running[partn] == 0) {
+        f->sink.offset = p->at[partn];
+    } else {
+        f->scratch = 1;
+        f->sink.offset = p->out_len + p->num_scratch * p->scratch_len;
+        p->num_scratch += 1;
+    }
+    if (pthread_create(&f->thread, NULL, run_fetch, f) != 0) {
+        panic("unable to start get thread: %s", system_error());
+    }
+    TRACE("asking dfs[%d] for part %d", f->dfsn, partn);
+    p->num_fetches += 1;
+    p->next[partn] += 1;
+    p->running[partn] += 1;
+    if (p->running[partn] == 1) {
+        p->started[partn] = now_ms();
+    }
+    return 0;
+}
 
-    usize complete_len = partlen[0] + partlen[1] + partlen[2] + partlen[3];
-    byte *complete_file = malloc(complete_len);
-    memcpy(complete_file, part[0], partlen[0]);
-    memcpy(complete_file + partlen[0], part[1], partlen[1]);
-    memcpy(complete_file + partlen[0] + partlen[1], part[2], partlen[2]);
-    memcpy(complete_file + partlen[0] + partlen[1] + partlen[2], part[3], partlen[3]);
+// STOPS EVERY OTHER REQUEST FOR A PART THAT HAS ARRIVED. CALLED WITH THE LOCK
+// HELD.
+void cancel_fetches(struct get_plan *p, int partn) {
+    for (int i = 0; i < p->num_fetches; ++i) {
+        struct fetch *f = &p->fetches[i];
+        if (f->partn == partn && !f->done && !f->cancelled) {
+            f->cancelled = 1;
+            if (f->fd >= 0) {
+                shutdown(f->fd, SHUT_RDWR);
+            }
+        }
+    }
+}
 
-    // DECRYPT FILE
-    byte mask = make_mask(password);
-    xor_file(complete_file, complete_len, mask);
+// ORDERS THE HOLDERS OF EVERY PART SO EACH SERVER IS FIRST IN LINE FOR ONE
+// PART. put_file STORES PARTS i AND i + 1 ON dfs[(i + mod) % 4], SO THE
+// SERVER HOLDING PARTS 0 AND 1 GIVES AWAY mod, AND PART n IS THEN ASKED OF
+// dfs[(n + mod) % 4] FIRST AND dfs[(n + mod + 3) % 4] IF THAT FAILS. IF NO
+// SERVER SHOWS WHICH PAIR IT HOLDS, HOLDERS STAY IN SERVER ORDER.
+void plan_parts(struct get_plan *p, struct part_stat stats[4][4]) {
+    int mod = -1;
+    for (int dfsn = 0; dfsn < 4 && mod == -1; ++dfsn) {
+        for (int i = 0; i < 4; ++i) {
+            if (stats[dfsn][i].status == SUCCESS && stats[dfsn][(i + 1) % 4].status == SUCCESS) {
+                mod = (dfsn - i + 4) % 4;
+                break;
+            }
+        }
+    }
+    for (int partn = 0; partn < 4; ++partn) {
+        p->num_holders[partn] = 0;
+        for (int k = 0; k < 4; ++k) {
+            int dfsn = mod == -1 ? k : (partn + mod + 4 - k) % 4;
+            if (stats[dfsn][partn].status == SUCCESS) {
+                p->holders[partn][p->num_holders[partn]++] = dfsn;
+            }
+        }
+        // THE PREFERRED HOLDER GIVES WAY TO THE OTHER ONLY IF IT IS
+        // CLEARLY WORSE, SO A HEALTHY CLUSTER STILL SPREADS PARTS EVENLY
+        int *h = p->holders[partn];
+        if (p->num_holders[partn] >= 2 && healthier(&p->dfs[h[1]], &p->dfs[h[0]])) {
+            int first = h[0];
+            h[0] = h[1];
+            h[1] = first;
+        }
+    }
+
+    // A PART PUT ENCODED WITHOUT ITS plain_len DOESN'T SAY HOW LONG IT IS
+    // (SEE size_parts)
+    for (int partn = 0; partn < 4; ++partn) {
+        struct part_stat const *st = &stats[p->holders[partn][0]][partn];
+        p->sized[partn] = p->num_holders[partn] > 0 && (st->codec == CODEC_NONE || st->plain_len != 0);
+        if (p->sized[partn]) {
+            p->part_len[partn] = st->codec == CODEC_NONE ? st->size : st->plain_len;
+        }
+    }
+}
+
+// FINDS THE LENGTH OF EVERY PART STAT COULDN'T GIVE ONE FOR BY ASKING ITS
+// HOLDERS FOR AN EMPTY RANGE OF IT, WHICH IS ANSWERED WITH THE PART'S PLAIN
+// LENGTH. A PART NONE OF ITS HOLDERS WILL SIZE IS TREATED AS HELD BY NONE OF
+// THEM.
+void size_parts(struct get_plan *p) {
+    for (int partn = 0; partn < 4; ++partn) {
+        for (int k = 0; k < p->num_holders[partn] && !p->sized[partn]; ++k) {
+            struct server *s = &p->dfs[p->holders[partn][k]];
+            int fd = take_connection(s);
+            if (fd < 0) {
+                continue;
+            }
+            struct response res = {0};
+            if (send_get_range_request(fd, p->username, p->password, p->part_paths[partn], 0, 0) == 0
+                && recv_get_range_response(fd, &res) == 0)
+            {
+                note_success(s, 0);
+                give_connection(s, fd);
+            } else {
+                note_failure(s);
+                close(fd);
+                res.status = PART_UNKNOWN;
+            }
+            if (res.status == SUCCESS) {
+                p->part_len[partn] = res.get.part_len;
+                p->sized[partn] = 1;
+            }
+            drop_response(&res);
+        }
+        if (!p->sized[partn]) {
+            p->num_holders[partn] = 0;
+            p->part_len[partn] = 0;
+        }
+    }
+}
+
+// LAYS OUT THE BYTES OF THE WINDOW [offset, offset + length) OF THE FILE THAT
+// EACH PART HOLDS, CLAMPED TO THE END OF THE FILE, ONE AFTER ANOTHER IN out.
+// RETURNS -1 IF THE WINDOW REACHES A PART NOBODY COULD SIZE, SINCE NEITHER IT
+// NOR ANY PART AFTER IT CAN BE PLACED.
+int place_parts(struct get_plan *p, u64 offset, u64 length) {
+    u64 start = 0;
+    p->out_len = 0;
+    p->scratch_len = 0;
+    for (int partn = 0; partn < 4; ++partn) {
+        p->len[partn] = 0;
+        p->from[partn] = 0;
+        p->at[partn] = p->out_len;
+    }
+    for (int partn = 0; partn < 4; ++partn) {
+        u64 from = offset > start ? offset : start;
+        if (from - offset >= length) {
+            break;
+        }
+        if (!p->sized[partn]) {
+            return -1;
+        }
+        u64 end = start + p->part_len[partn];
+        if (from < end) {
+            u64 want = length - (from - offset);
+            p->from[partn] = from - start;
+            p->len[partn] = want < end - from ? want : end - from;
+            p->at[partn] = p->out_len;
+            p->out_len += p->len[partn];
+        }
+        if (p->len[partn] > p->scratch_len) {
+            p->scratch_len = p->len[partn];
+        }
+        start = end;
+    }
+    return 0;
+}
+
+// FETCHES EVERY PART OF path EXACTLY ONCE IN THE COMMON CASE. A STAT OF ALL
+// FOUR SERVERS, WHICH MOVES NO DATA, SHOWS WHERE EACH PART IS, THEN EACH PART
+// IS ASKED OF ONE HOLDER, ALL FOUR AT ONCE AND EACH FROM A DIFFERENT SERVER.
+// A PART THAT FAILS, OR COMES BACK CORRUPT, IS ASKED OF ITS NEXT HOLDER
+// STRAIGHT AWAY. ONE THAT IS SLOW IS HEDGED: ONCE IT HAS RUN HEDGE_FACTOR
+// TIMES AS LONG AS THE FIRST PART TO FINISH TOOK, ITS NEXT HOLDER IS ASKED
+// TOO, AND WHICHEVER ANSWERS FIRST WINS WHILE THE OTHER IS SHUT DOWN.
+//
+// PARTS ARE UNMASKED AS THEY ARRIVE AND WRITTEN AT THEIR PLACE IN A FILE
+// ALLOCATED AT ITS FULL SIZE UP FRONT, WHICH REPLACES filename.received ONLY
+// ONCE EVERY PART IS IN, SO A GET TAKES A FEW CHUNKS OF MEMORY HOWEVER LARGE
+// THE FILE IS, HEDGES INCLUDED. A ranged GET DOES THE SAME FOR JUST THE
+// BYTES OF EACH PART THAT FALL IN [offset, offset + length).
+int get_window(char const *username,
+               char const *password,
+               struct server dfs[4],
+               char const *path,
+               int ranged,
+               u64 offset,
+               u64 length)
+{
+    struct fetch *won[4] = {0};
+    int wanted[4];
+    int failed[4] = {0};
+    int err = -1;
+    struct part_stat stats[4][4];
+    struct get_plan plan;
+    memset(&plan, 0, sizeof(struct get_plan));
+    plan.username = username;
+    plan.password = password;
+    plan.dfs = dfs;
+    plan.mask = make_mask(password);
+    plan.ranged = ranged;
+    for (int partn = 0; partn < 4; ++partn) {
+        plan.part_paths[partn] = make_part_path(path, partn);
+    }
+    pthread_mutex_init(&plan.lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&plan.changed, &attr);
+    pthread_condattr_destroy(&attr);
 
     char *get_filename = make_get_filename(path);
-    println("success getting file, writing to \"%s\"", get_filename);
-    write_file(get_filename, complete_file, complete_len);
+    char *tmp_filename = malloc(strlen(get_filename) + strlen(".tmp") + 1);
+    sprintf(tmp_filename, "%s.tmp", get_filename);
+    plan.out = open(tmp_filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (plan.out < 0) {
+        println("failed to get \"%s\": cannot write \"%s\": %s", path, tmp_filename, system_error());
+        goto cleanup;
+    }
+
+    stat_parts(username, password, dfs, path, stats);
+    plan_parts(&plan, stats);
+    size_parts(&plan);
+    if (place_parts(&plan, offset, length) != 0) {
+        println("failed to get \"%s\": file incomplete", path);
+        goto cleanup;
+    }
+    if (plan.out_len > 0 && fallocate(plan.out, 0, 0, plan.out_len) != 0) {
+        if (errno != EOPNOTSUPP) {
+            println("failed to get \"%s\": cannot allocate %llu bytes: %s",
+                    path, (unsigned long long)plan.out_len, system_error());
+            goto cleanup;
+        }
+        ftruncate(plan.out, plan.out_len);
+    }
+
+    pthread_mutex_lock(&plan.lock);
+    for (int partn = 0; partn < 4; ++partn) {
+        // AN EMPTY PART IS STILL FETCHED WHOLE, SINCE ITS CHECKSUM SAYS
+        // WHETHER IT REALLY IS EMPTY
+        wanted[partn] = !ranged || plan.len[partn] > 0;
+        if (wanted[partn] && start_fetch(&plan, partn) != 0) {
+            failed[partn] = 1;
+        }
+    }
+    u64 first_ms = 0;
+    while (1) {
+        for (int i = 0; i < plan.num_fetches; ++i) {
+            struct fetch *f = &plan.fetches[i];
+            if (!f->done || f->seen) {
+                continue;
+            }
+            f->seen = 1;
+            int partn = f->partn;
+            plan.running[partn] -= 1;
+            if (won[partn]) {
+                continue;
+            }
+            // A PART THAT ISN'T THE SIZE IT WAS PLANNED AT WOULDN'T FIT ITS PLACE
+            if (f->res.status == SUCCESS && f->res.get.file.len != plan.len[partn]) {
+                TRACE("part %d from dfs[%d] has %zu bytes, expected %llu",
+                      partn, f->dfsn, f->res.get.file.len, (unsigned long long)plan.len[partn]);
+                f->res.status = CORRUPT_PART;
+            }
+            if (f->res.status == SUCCESS) {
+                won[partn] = f;
+                if (!first_ms) {
+                    first_ms = now_ms() - plan.started[partn] + 1;
+                }
+                cancel_fetches(&plan, partn);
+                continue;
+            }
+            if (f->res.status == CORRUPT_PART) {
+                println("part %d from dfs[%d] is corrupt", partn, f->dfsn);
+            } else if (f->res.status == INVALID_IDENTITY) {
+                println("invalid username/password: %s:%s", username, password);
+            }
+            TRACE("no part %d from dfs[%d]", partn, f->dfsn);
+            if (plan.running[partn] == 0 && start_fetch(&plan, partn) != 0) {
+                failed[partn] = 1;
+            }
+        }
+
+        int waiting = 0;
+        u64 now = now_ms();
+        for (int partn = 0; partn < 4; ++partn) {
+            if (!wanted[partn] || won[partn] || failed[partn]) {
+                continue;
+            }
+            waiting += 1;
+            u64 hedge_ms = HEDGE_FACTOR * first_ms > HEDGE_MIN_MS ? HEDGE_FACTOR * first_ms : HEDGE_MIN_MS;
+            if (first_ms && plan.running[partn] == 1 && now - plan.started[partn] > hedge_ms
+                && start_fetch(&plan, partn) == 0)
+            {
+                TRACE("hedging part %d after %llu ms", partn, (unsigned long long)(now - plan.started[partn]));
+            }
+        }
+        if (waiting == 0) {
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += PLAN_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&plan.changed, &plan.lock, &deadline);
+    }
+    pthread_mutex_unlock(&plan.lock);
+
+    for (int i = 0; i < plan.num_fetches; ++i) {
+        pthread_join(plan.fetches[i].thread, NULL);
+        drop_response(&plan.fetches[i].res);
+    }
+
+    for (int partn = 0; partn < 4; ++partn) {
+        if (wanted[partn] && !won[partn]) {
+            println("failed to get \"%s\": file incomplete", path);
+            goto cleanup;
+        }
+    }
 
+    // HEDGES THAT WON ARE COPIED INTO PLACE, OVER ANYTHING A LOSING REQUEST
+    // LEFT THERE. EVERY REQUEST HAS BEEN JOINED, SO NONE IS STILL WRITING.
+    for (int partn = 0; partn < 4; ++partn) {
+        struct fetch *f = won[partn];
+        if (f && f->scratch && copy_range(plan.out, f->sink.offset, plan.out, plan.at[partn], plan.len[partn]) != 0)
+        {
+            println("failed to get \"%s\": cannot write \"%s\": %s", path, tmp_filename, system_error());
+            goto cleanup;
+        }
+    }
+    // DROPS THE SCRATCH SLOTS
+    int written = ftruncate(plan.out, plan.out_len) == 0;
+    written = close(plan.out) == 0 && written;
+    plan.out = -1;
+    if (!written || rename(tmp_filename, get_filename) != 0) {
+        println("failed to get \"%s\": cannot write \"%s\": %s", path, get_filename, system_error());
+        goto cleanup;
+    }
+    if (ranged) {
+        println("success getting %llu bytes at offset %llu, writing to \"%s\"",
+                (unsigned long long)plan.out_len, (unsigned long long)offset, get_filename);
+    } else {
+        println("success getting file, writing to \"%s\"", get_filename);
+    }
+    err = 0;
+
+cleanup:
+    if (plan.out >= 0) {
+        close(plan.out);
+    }
+    if (err != 0) {
+        unlink(tmp_filename);
+    }
+    free(tmp_filename);
     free(get_filename);
-    return 0;
+    pthread_cond_destroy(&plan.changed);
+    pthread_mutex_destroy(&plan.lock);
+    for (int partn = 0; partn < 4; ++partn) {
+        free(plan.part_paths[partn]);
+    }
+    return err;
 }
 
-int list_files(char const *username, char const *password, struct server dfs[4], char const *path) {
-    char **filenames = NULL;
-    int (*parts)[4] = NULL;
-    usize count = 0;
+// FETCHES ALL OF path (SEE get_window)
+int get_file(char const *username, char const *password, struct server dfs[4], char const *path) {
+    return get_window(username, password, dfs, path, 0, 0, (u64)-1);
+}
 
-    char **directories = NULL;
-    usize num_directories = 0;
+// READS length BYTES OF path FROM offset WITHOUT FETCHING THE REST OF IT
+int get_range(char const *username,
+              char const *password,
+              struct server dfs[4],
+              char const *path,
+              u64 offset,
+              u64 length)
+{
+    return get_window(username, password, dfs, path, 1, offset, length);
+}
 
-    for (int dfsn = 0; dfsn < 4; ++dfsn) {
-        int conn = connect_with_timeout(&dfs[dfsn].addr, CONNECT_TIMEOUT_MS);
-        if (conn < 0) {
-            TRACE("unable to connect to dfs[%d]", dfsn);
+// RECEIVES THE ANSWER TO A LOGIN SENT AHEAD OF OTHER REQUESTS ON fd, WHICH
+// COMES BEFORE THEIRS. RETURNS ITS STATUS, OR -1 IF NONE CAME.
+int recv_login(int fd) {
+    struct response res = {0};
+    int status = recv_login_response(fd, &res) == 0 ? res.status : -1;
+    drop_response(&res);
+    if (status != -1 && status != SUCCESS) {
+        println("login failed: %s", status_to_string(status));
+    }
+    return status;
+}
+
+// A FILE OR DIRECTORY SEEN WHILE LISTING. FILES ARE KEYED BY THE NAME THEIR
+// PARTS SHARE, AND COMPLETE ONCE ALL FOUR PARTS HAVE TURNED UP.
+struct listed {
+    char *name;
+    u64 part_sizes[4];
+    byte parts;
+    byte printed;
+};
+
+// OPEN-ADDRESSED HASH TABLE OF struct listed, SO MERGING A PAGE COSTS TIME
+// PROPORTIONAL TO THE PAGE, NOT TO EVERYTHING LISTED SO FAR
+struct listing {
+    struct listed *slots;
+    usize capacity;
+    usize len;
+};
+
+struct listed *probe_listing(struct listed *slots, usize capacity, char const *name, usize len) {
+    usize i = hash_name(name, len) & (capacity - 1);
+    while (slots[i].name && (strncmp(slots[i].name, name, len) != 0 || slots[i].name[len] != '\0')) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+// RETURNS THE ENTRY FOR THE FIRST len BYTES OF name, ADDING IT IF NEEDED
+struct listed *find_listed(struct listing *l, char const *name, usize len) {
+    if (2 * (l->len + 1) > l->capacity) {
+        usize capacity = l->capacity ? l->capacity * 2 : 256;
+        struct listed *slots = calloc(capacity, sizeof(struct listed));
+        for (usize i = 0; i < l->capacity; ++i) {
+            if (l->slots[i].name) {
+                *probe_listing(slots, capacity, l->slots[i].name, strlen(l->slots[i].name)) = l->slots[i];
+            }
+        }
+        free(l->slots);
+        l->slots = slots;
+        l->capacity = capacity;
+    }
+    struct listed *e = probe_listing(l->slots, l->capacity, name, len);
+    if (!e->name) {
+        e->name = strndup(name, len);
+        l->len += 1;
+    }
+    return e;
+}
+
+void drop_listing(struct listing *l) {
+    for (usize i = 0; i < l->capacity; ++i) {
+        free(l->slots[i].name);
+    }
+    free(l->slots);
+    memset(l, 0, sizeof(struct listing));
+}
+
+u64 listed_size(struct listed const *f) {
+    return f->part_sizes[0] + f->part_sizes[1] + f->part_sizes[2] + f->part_sizes[3];
+}
+
+// ADDS ONE PAGE OF A SERVER'S LISTING, PRINTING EACH FILE AS SOON AS ITS
+// LAST PART SHOWS UP. header SAYS WHETHER "files:" HAS BEEN PRINTED YET.
+void merge_list_page(struct listing *files, struct listing *directories, struct response const *res, int *header) {
+    for (usize i = 0; i < res->list.count; ++i) {
+        struct list_entry const *e = &res->list.entries[i];
+        char const *name = entry_name(res, i);
+        if (e->kind == ENTRY_DIR) {
+            find_listed(directories, name, e->name_len);
             continue;
         }
+        // PART FILES ARE NAMED .filename.N
+        if (e->kind != ENTRY_FILE || e->name_len < 4 || name[0] != '.' ||
+            name[e->name_len - 2] != '.' || name[e->name_len - 1] < '0' || name[e->name_len - 1] > '3')
+        {
+            continue;
+        }
+        int part = name[e->name_len - 1] - '0';
+        struct listed *f = find_listed(files, &name[1], e->name_len - 3);
+        f->parts |= 1 << part;
+        f->part_sizes[part] = e->size;
+        if (f->parts == 0xf && !f->printed) {
+            if (!*header) {
+                println("files:");
+                *header = 1;
+            }
+            println("%s (%llu bytes)", f->name, (unsigned long long)listed_size(f));
+            f->printed = 1;
+        }
+    }
+}
 
-        send_list_request(conn, username, password, path);
+// LISTS path ON EVERY SERVER AT ONCE, A PAGE AT A TIME, ASKING EACH SERVER
+// FOR ITS NEXT PAGE AS SOON AS IT HAS ANSWERED. FILES ARE PRINTED AS SOON AS
+// ALL THEIR PARTS HAVE BEEN SEEN, SO THE FIRST ONES SHOW UP AFTER A PAGE OR
+// TWO NO MATTER HOW BIG THE DIRECTORY IS, AND AT MOST ONE PAGE PER SERVER IS
+// HELD AT A TIME. EACH
+// CONNECTION LOGS IN ONCE, AHEAD OF ITS FIRST PAGE, AND EVERY PAGE AFTER
+// THAT IS ASKED FOR WITHOUT CREDENTIALS.
+int list_files(char const *username, char const *password, struct server dfs[4], char const *path) {
+    struct listing files = {0};
+    struct listing directories = {0};
+    u64 cursor[4] = {0};
+    byte logged_in = 0;
+    int header = 0;
+    int err = 0;
+
+    struct fanout f;
+    start_fanout(&f, dfs, 0);
+    int connected;
+    int dfsn;
+    while (err == 0 && (dfsn = next_server(&f, &connected)) >= 0) {
+        int fd = f.fd[dfsn];
+        if (connected) {
+            send_login_request(fd, username, password);
+            send_list_request(fd, "", "", path, LIST_METADATA, 0, LIST_PAGE_DEFAULT);
+            continue;
+        }
         struct response res = {0};
-        recv_list_response(conn, &res);
-        if (res.status != SUCCESS) {
+        int more = 0;
+        int answered = 0;
+        int login = logged_in & (1 << dfsn) ? SUCCESS : recv_login(fd);
+        logged_in |= 1 << dfsn;
+        if (login == -1 || recv_list_response(fd, &res) != 0) {
+            TRACE("no list response from dfs[%d]", dfsn);
+        } else if (login != SUCCESS) {
+            answered = 1;
+            err = -1;
+        } else if (res.status != SUCCESS) {
+            answered = 1;
             if (res.status == NOT_DIRECTORY) {
                 println("\"%s\" is not a directory", path);
             } else if (res.status == FILE_NOT_FOUND) {
@@ -318,105 +1396,120 @@ int list_files(char const *username, char const *password, struct server dfs[4],
             } else {
                 panic("invalid res.status error for list");
             }
-            close(conn);
-            return -1;
+            err = -1;
+        } else {
+            merge_list_page(&files, &directories, &res, &header);
+            more = res.list.flags & LIST_MORE;
+            cursor[dfsn] = res.list.cursor;
+            answered = 1;
         }
+        drop_response(&res);
+        if (more) {
+            // EACH SERVER MOVES ON TO ITS NEXT PAGE AS SOON AS IT HAS ANSWERED
+            send_list_request(fd, "", "", path, LIST_METADATA, cursor[dfsn], LIST_PAGE_DEFAULT);
+        } else {
+            finish_server(&f, dfsn, answered);
+        }
+    }
+    drop_fanout(&f);
 
-        // ADD FILES TO LIST
-        for (usize i = 0; i < res.list.count; ++i) {
-            isize filename_idx = -1;
-            int part = -1;
-            char const *part_filename = res.list.filenames[i];
-            if (part_filename[0] != '.') {
-                int already_in = 0;
-                for (usize j = 0; j < num_directories; ++j) {
-                    if (strings_equal(directories[j], part_filename)) {
-                        already_in = 1;
-                        break;
-                    }
-                }
-                if (!already_in) {
-                    // DIRECTORY
-                    num_directories += 1;
-                    directories = realloc(directories, num_directories * sizeof(char *));
-                    directories[num_directories - 1] = strdup(part_filename);
-                }
-                continue;
-            }
-
-            char *filename = unmake_part_filename(part_filename, &part);
-            TRACE("part filename %s, filename %s, part %d", part_filename, filename, part);
-
-            for (usize j = 0; j < count; ++j) {
-                if (strings_equal(filenames[j], filename)) {
-                    filename_idx = j;
-                    break;
-                }
+    if (err == 0) {
+        if (!header) {
+            println("files:");
+        }
+        for (usize i = 0; i < files.capacity; ++i) {
+            struct listed const *f = &files.slots[i];
+            if (f->name && !f->printed) {
+                println("%s [incomplete]", f->name);
             }
-            if (filename_idx == -1) {
-                count += 1;
-                filenames = realloc(filenames, count * sizeof(char*));
-                parts = realloc(parts, count * sizeof(int) * 4);
-                filename_idx = count - 1;
-                filenames[filename_idx] = strdup(filename);
-                for (int k = 0; k < 4; ++k) {
-                    parts[filename_idx][k] = 0;
-                }
+        }
+        if (files.len == 0) {
+            println("(no files)");
+        }
+        println("directories:");
+        if (directories.len == 0) {
+            println("(no directories)");
+        }
+        for (usize i = 0; i < directories.capacity; ++i) {
+            if (directories.slots[i].name) {
+                println("%s", directories.slots[i].name);
             }
-            parts[filename_idx][part] = 1;
-
-            free(filename);
         }
     }
 
-    println("files:");
-    if (count == 0) {
-        println("(no files)");
-    }
-    for (usize i = 0; i < count; ++i) {
-        int complete = 1;
-        for (int j = 0; j < 4; ++j) {
-            if (!parts[i][j]) {
-                complete = 0;
-                break;
+    drop_listing(&files);
+    drop_listing(&directories);
+    return err;
+}
+
+// PRINTS WHERE EVERY PART OF path IS, HOW BIG THE FILE IS AND WHETHER IT
+// CAN BE REASSEMBLED, FROM METADATA ALONE
+int stat_file(char const *username, char const *password, struct server dfs[4], char const *path) {
+    struct part_stat stats[4][4];
+    stat_parts(username, password, dfs, path, stats);
+
+    u64 size = 0;
+    int found = 0;
+    for (int partn = 0; partn < 4; ++partn) {
+        struct part_stat const *first = NULL;
+        int differ = 0;
+        print("part %d:", partn);
+        for (int dfsn = 0; dfsn < 4; ++dfsn) {
+            struct part_stat const *st = &stats[dfsn][partn];
+            if (st->status != SUCCESS) {
+                continue;
             }
+            if (!first) {
+                first = st;
+                print(" %llu bytes", (unsigned long long)st->plain_len);
+                if (st->checksum) {
+                    print(", crc32c %08x", (u32)st->checksum);
+                }
+                print(", on");
+            } else if (st->plain_len != first->plain_len || st->checksum != first->checksum) {
+                differ = 1;
+            }
+            print(" dfs[%d]", dfsn);
         }
-        if (complete) {
-            println("%s", filenames[i]);
-        } else {
-            println("%s [incomplete]", filenames[i]);
+        if (!first) {
+            println(" missing");
+            continue;
         }
+        println("%s", differ ? " (copies differ)" : "");
+        size += first->plain_len;
+        found += 1;
     }
-    println("directories:");
-    if (num_directories == 0) {
-        println("(no directories)");
-    }
-    for (usize i = 0; i < num_directories; ++i) {
-        println("%s", directories[i]);
+    if (found == 0) {
+        println("\"%s\" not found", path);
+        return -1;
     }
-
-    for (usize i = 0; i < count; ++i) {
-        free(filenames[i]);
-        filenames[i] = NULL;
+    if (found < 4) {
+        println("\"%s\" is incomplete", path);
+        return -1;
     }
-    free(filenames);
-    free(parts);
-
+    println("\"%s\" is complete, %llu bytes", path, (unsigned long long)size);
     return 0;
 }
 
+// CREATES path ON EVERY SERVER AT ONCE, REPORTING EACH ANSWER AS IT ARRIVES
 int make_directory(char const *username, char const *password, struct server dfs[4], char const *path) {
-    for (int dfsn = 0; dfsn < 4; ++dfsn) {
-        int fd = connect_with_timeout(&dfs[dfsn].addr, CONNECT_TIMEOUT_MS);
-        if (fd < 0) {
-            TRACE("unable to connect to dfs[%s]", dfsn);
+    struct fanout f;
+    start_fanout(&f, dfs, 0);
+    int connected;
+    int dfsn;
+    while ((dfsn = next_server(&f, &connected)) >= 0) {
+        if (connected) {
+            send_mkdir_request(f.fd[dfsn], username, password, path);
             continue;
         }
 
-        send_mkdir_request(fd, username, password, path);
-
         struct response res = {0};
-        recv_mkdir_response(fd, &res);
+        int err = recv_mkdir_response(f.fd[dfsn], &res);
+        finish_server(&f, dfsn, err == 0);
+        if (err != 0) {
+            TRACE("no mkdir response from dfs[%d]", dfsn);
+            continue;
+        }
 
         if (res.status == SUCCESS) {
             println("success creating directory \"%s\" on dfs[%d]", path, dfsn);
@@ -428,6 +1521,7 @@ int make_directory(char const *username, char const *password, struct server dfs
             panic("invalid response status from dfs[%d]", dfsn);
         }
     }
+    drop_fanout(&f);
     return 0;
 }
 
@@ -437,8 +1531,12 @@ int main(int argc, char const *const args[]) {
     char *dfc_conf_path = NULL;
     char *username = NULL;
     char *password = NULL;
+    u64 codec = CODEC_NONE;
     struct server dfs[4] = {0};
     int err = -1;
+    for (int i = 0; i < 4; ++i) {
+        pthread_mutex_init(&dfs[i].lock, NULL);
+    }
 
     if (argc < 2) {
         println("not enough arguments");
@@ -452,7 +1550,7 @@ int main(int argc, char const *const args[]) {
         goto cleanup;
     }
 
-    err = read_conf(dfc_conf_path, &username, &password, dfs);
+    err = read_conf(dfc_conf_path, &username, &password, &codec, dfs);
     if (err != 0) {
         println("unable to read config file: %s", system_error());
         goto cleanup;
@@ -463,6 +1561,7 @@ int main(int argc, char const *const args[]) {
     }
     println("username %s", username);
     println("password %s", password);
+    println("compression %s", codec == CODEC_ZLIB ? "zlib" : "none");
 
     char *line = NULL;
     usize linelen = 0;
@@ -490,18 +1589,18 @@ int main(int argc, char const *const args[]) {
         //print_request(&r);
 
         if (r.type == PUT) {
-            // ENCRYPT FILE
-            byte mask = make_mask(password);
-            xor_file(r.put.file.buf, r.put.file.len, mask);
-
-            put_file(username, password, dfs, r.put.path, r.put.file.buf, r.put.file.len);
+            put_file(username, password, dfs, r.put.path, r.put.source, codec);
         } else if (r.type == GET) {
             // DECRYPTION INSIDE GET_FILE
             get_file(username, password, dfs, r.get.path);
+        } else if (r.type == GET_RANGE) {
+            get_range(username, password, dfs, r.get_range.path, r.get_range.offset, r.get_range.length);
         } else if (r.type == LIST) {
             list_files(username, password, dfs, r.list.path);
         } else if (r.type == MKDIR) {
             make_directory(username, password, dfs, r.mkdir.path);
+        } else if (r.type == STAT) {
+            stat_file(username, password, dfs, r.stat.paths[0]);
         }
 
         drop_request(&r);
@@ -510,6 +1609,8 @@ int main(int argc, char const *const args[]) {
 cleanup:
     free(dfc_conf_path);
     for (int i = 0; i < 4; ++i) {
+        drop_connections(&dfs[i]);
+        pthread_mutex_destroy(&dfs[i].lock);
         free(dfs[i].ip);
         free(dfs[i].port);
     }
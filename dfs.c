@@ -4,6 +4,9 @@
 #include "request.h"
 #include "response.h"
 #include "util.h"
+#include "pool.h"
+#include "uring.h"
+#include "slab.h"
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -13,11 +16,25 @@
 #include <assert.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #define MIN_PORT    5000
 #define MAX_EVENTS      1024
-#define INIT_BUF_LEN    1024
+#define READ_BUF_MAX    65536
+#define UPLOAD_CHUNK    65536
+#define DOWNLOAD_CHUNK  (1 << 20)
 #define DFS_CONF    "dfs.conf"
+#define MAX_THREADS     256
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS     256
+#define DEFAULT_MEMORY_BUDGET_MB        256
+#define DEFAULT_CONNECTION_BUDGET_KB    1024
+// epoll_event.data OF THE TWO NON-CONNECTION FDS, NEVER VALID SLAB HANDLES
+#define LISTENER_HANDLE     SLAB_NO_HANDLE
+#define COMPLETIONS_HANDLE  (SLAB_NO_HANDLE - 1)
 
 int is_valid_port(char const *port) {
     unsigned long int ul = strtoul(port, NULL, 10);
@@ -28,330 +45,751 @@ int is_valid_port(char const *port) {
     }
 }
 
-int main(int argc, char const *const args[]) {
-    int tcp_listener = 0;
-    int epoll = 0;
-    char *root_directory = NULL;
-    char *port = NULL;
-    int err = -1;
+// EVERY CONNECTION HOLDS AN FD, SO RAISE THE SOFT LIMIT AS FAR AS THE HARD
+// LIMIT ALLOWS RATHER THAN STOPPING AT THE USUAL 1024
+void raise_fd_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        TRACE("getrlimit: %s", system_error());
+        return;
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            TRACE("setrlimit: %s", system_error());
+            return;
+        }
+    }
+    TRACE("fd limit %llu", (unsigned long long)limit.rlim_cur);
+}
 
-    if (argc < 3) {
-        println("not enough arguments");
-        println("usage: %s [root directory] [port]", args[0]);
-        goto cleanup;
+struct event_loop {
+    pthread_t thread;
+    int tcp_listener;
+    int epoll;
+    struct pool *pool;
+    struct completions completions;
+    struct buffer_pool buffer_pool;
+    // EVENTS CARRY THE CONNECTION'S SLAB HANDLE RATHER THAN ITS FD, SO AN
+    // EVENT FOR A CONNECTION CLOSED EARLIER IN THE SAME BATCH IS DROPPED
+    // INSTEAD OF BEING DELIVERED TO A NEW CONNECTION THAT REUSED THE FD
+    struct slab connections;
+};
+
+void watch_connection(struct event_loop *loop, struct connection *c, u32 events) {
+    struct epoll_event ev = {
+        .events = events | EPOLLRDHUP | EPOLLET,
+        .data.u64 = c->handle,
+    };
+    int err = epoll_ctl(loop->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+    if (err != 0) {
+        TRACE("error changing %d events: %s", c->fd, system_error());
     }
+}
 
-    root_directory = realpath(args[1], NULL);
-    if (!root_directory) {
-        println("invalid root directory \"%s\": %s", args[1], system_error());
-        goto cleanup;
+void close_connection(struct event_loop *loop, struct connection *c) {
+    int err = epoll_ctl(loop->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+    if (err != 0) {
+        TRACE("error removing %d from epoll", c->fd);
+    } else {
+        TRACE("epoll -> %d", c->fd);
     }
+    u64 handle = c->handle;
+    drop_connection(c);
+    slab_free(&loop->connections, handle);
+}
 
-    port = strdup(args[2]);
-    if (!is_valid_port(port)) {
-        println("invalid port: %s", port);
-        goto cleanup;
+void accept_connections(struct event_loop *loop) {
+    // LOOP ACCEPT
+    while (1) {
+        // ACCEPT CONNECTION
+        int connection_fd = accept4(loop->tcp_listener, NULL, NULL, SOCK_CLOEXEC|SOCK_NONBLOCK);
+        if (connection_fd == -1) {
+            TRACE("accept4: %s", system_error());
+            break;
+        }
+        u64 handle;
+        struct connection *c = slab_alloc(&loop->connections, &handle);
+        if (!c) {
+            TRACE("no room for connection %d", connection_fd);
+            close(connection_fd);
+            continue;
+        }
+        // WAIT FOR READ EVENTS ON NEW CONNECTION
+        struct epoll_event connection_readable = {
+            .events = EPOLLIN | EPOLLRDHUP | EPOLLET,
+            .data.u64 = handle,
+        };
+        int err = epoll_ctl(loop->epoll, EPOLL_CTL_ADD, connection_fd, &connection_readable);
+        if (err != 0) {
+            TRACE("epoll_ctl: %s", system_error());
+            close(connection_fd);
+            slab_free(&loop->connections, handle);
+            continue;
+        }
+        // BUFFERS ARE TAKEN FROM THE POOL ONCE THERE IS SOMETHING TO READ
+        *c = (struct connection){
+            .fd = connection_fd,
+            .handle = handle,
+            .buffers = &loop->buffer_pool,
+        };
     }
+}
 
-    struct users user = {0};
-    {
-        FILE *file = fopen(DFS_CONF, "r");
-        if (!file) {
-            println("unable to open %s: %s", DFS_CONF, system_error());
-            goto cleanup;
+// READS NEW BYTES UNTIL THE SOCKET WOULD BLOCK OR THE READ BUFFER IS FULL.
+// THE BUFFER NEVER GROWS PAST READ_BUF_MAX OR THE CONNECTION BUDGET: REQUEST
+// HEADERS ALWAYS FIT, AND PUT BODIES ARE STREAMED OUT OF IT BY pump_upload.
+// WHILE THE CONNECTION HAS REQUESTS IN FLIGHT IT ONLY GROWS WITHIN THE
+// MEMORY BUDGET; OTHERWISE IT COULD NEVER MAKE PROGRESS, SO IT ALWAYS GROWS.
+// RETURNS -1 IF THE OTHER SIDE CLOSED THE CONNECTION, 0 IF THE SOCKET WOULD
+// BLOCK, 1 IF THE BUFFER FILLED UP FIRST.
+int read_connection(struct connection *c) {
+    usize max = c->buffers->budget->connection_limit;
+    if (max > READ_BUF_MAX) {
+        max = READ_BUF_MAX;
+    }
+    int force = c->pipeline.len == 0 && !c->download.job;
+
+    int status = 0;
+    while (1) {
+        if (c->read.end == c->read.capacity) {
+            // MOVE UNPARSED BYTES BACK TO THE START IF THAT MAKES ANY ROOM,
+            // OTHERWISE DOUBLE THE BUFFER
+            usize want = c->read.parse_idx > 0 ? 1 : c->read.capacity > 0 ? c->read.capacity : BUFFER_MIN;
+            if (reserve_read(c, want, max, force) != 0) {
+                status = 1;
+                break;
+            }
         }
-        char *line_buf = NULL;
-        usize line_buf_len = 0;
-        for (usize n = getline(&line_buf, &line_buf_len, file);
-             n != -1;
-             n = getline(&line_buf, &line_buf_len, file))
-        {
-            if (user.len == user.capacity) {
-                usize new_capacity = user.capacity == 0 ? 1 : user.capacity * 2;
-                user.username = realloc(user.username, sizeof(char *) * new_capacity);
-                user.password = realloc(user.password, sizeof(char *) * new_capacity);
-                user.capacity = new_capacity;
+        isize n = read(c->fd, &c->read.buf[c->read.end], c->read.capacity - c->read.end);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                status = -1;
+                break;
             }
-            line_buf[n - 1] = '\0';
-            usize username_len = strchr(&line_buf[0], ' ') - &line_buf[0];
-            usize num_spaces = strspn(&line_buf[username_len], " ");
-            usize password_idx = username_len + num_spaces;
-            char *username = strndup(&line_buf[0], username_len);
-            char *password = strdup(&line_buf[password_idx]);
-            user.username[user.len] = username;
-            user.password[user.len] = password;
-            user.len += 1;
-            
-        }
-        free(line_buf);
-        fclose(file);
-    }
-       
-
-    TRACE("starting dfs: root directory %s, port %s", root_directory, port);
-
-    tcp_listener = make_tcp_listener("127.0.0.1", port);
-    if (tcp_listener == -1) {
-        println("error creating tcp listening socket: %s", system_error());
-        goto cleanup;
+        }
+        TRACE("%d -> %zd", c->fd, n);
+        if (n == 0) {
+            status = -1;
+            break;
+        }
+        c->read.end += n;
     }
+    // HAND BACK A BUFFER NOTHING WAS READ INTO
+    consume_read(c, 0);
+    return status;
+}
 
-    err = set_nonblocking(tcp_listener, 1);
-    if (err != 0) {
-        println("error making tcp listening socket non-blocking: %s", system_error());
-        goto cleanup;
+// PARSES EVERY COMPLETE REQUEST IN THE READ BUFFER THAT can_dispatch ALLOWS
+// AND HANDS THEM TO THE WORKER POOL, SO PIPELINED REQUESTS RUN IN PARALLEL.
+// A PUT IS DISPATCHED AS SOON AS ITS PATH HAS ARRIVED: THE WORKER OPENS THE
+// PART FILE AND THE BODY IS STREAMED INTO IT BY pump_upload.
+// RETURNS THE NUMBER OF REQUESTS DISPATCHED.
+int dispatch_requests(struct event_loop *loop, struct connection *c) {
+    int dispatched = 0;
+    while (can_dispatch(c)) {
+        struct job *j = calloc(1, sizeof(struct job));
+        if (parse_request(c, &j->req) != 1) {
+            free(j);
+            break;
+        }
+
+        j->user = authenticate(c, loop->pool->users, &j->req);
+        j->completions = &loop->completions;
+        j->context = c;
+        if (j->req.type == PUT) {
+            c->upload.active = 1;
+            c->upload.remaining = j->req.put.file.len;
+        }
+        push_pipeline(c, j);
+        submit_job(loop->pool, j);
+        dispatched += 1;
     }
+    return dispatched;
+}
 
-    epoll = epoll_create1(EPOLL_CLOEXEC);
-    if (epoll == -1) {
-        println("unable to create epoll instance: %s", system_error());
-        goto cleanup;
+// WRITES BODY BYTES TO THE PART FILE, OR DROPS THEM IF IT COULDN'T BE OPENED
+void store_upload(struct connection *c, byte const *buf, usize len) {
+    struct job *j = c->upload.job;
+    while (j->res.fd > 0 && len > 0) {
+        isize n = write(j->res.fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TRACE("error writing upload: %s", system_error());
+            close(j->res.fd);
+            j->res.fd = 0;
+            j->res.status = INVALID_PATH;
+            break;
+        }
+        buf += n;
+        len -= n;
     }
+}
 
-    {
-        struct epoll_event accept_event = {
-            .events = EPOLLIN|EPOLLET,
-            .data.fd = tcp_listener,
-        };
-        err = epoll_ctl(epoll, EPOLL_CTL_ADD, tcp_listener, &accept_event);
-        if (err != 0) {
-            println("error registering listener with epoll: %s\n", system_error());
-            goto cleanup;
+// MOVES ONE CHUNK OF BODY FROM THE SOCKET TO THE PART FILE THROUGH A PIPE,
+// WITHOUT COPYING IT THROUGH USERSPACE. RETURNS LIKE read(2).
+isize splice_upload(struct connection *c, usize len) {
+    struct job *j = c->upload.job;
+    if (c->upload.pipe[0] == 0) {
+        if (pipe2(c->upload.pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+            return -1;
+        }
+    }
+
+    isize n = splice(c->fd, NULL, c->upload.pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0) {
+        return n;
+    }
+    usize moved = 0;
+    while (moved < (usize)n) {
+        isize m = splice(c->upload.pipe[0], NULL, j->res.fd, NULL, n - moved, SPLICE_F_MOVE);
+        if (m <= 0) {
+            if (m == -1 && errno == EINTR) {
+                continue;
+            }
+            TRACE("error splicing upload: %s", system_error());
+            close(j->res.fd);
+            j->res.fd = 0;
+            j->res.status = INVALID_PATH;
+            break;
+        }
+        moved += m;
+    }
+    while (moved < (usize)n) {
+        // PART FILE FAILED, DRAIN THE PIPE
+        byte scratch[4096];
+        usize want = n - moved < sizeof(scratch) ? n - moved : sizeof(scratch);
+        isize m = read(c->upload.pipe[0], scratch, want);
+        if (m <= 0) {
+            break;
+        }
+        moved += m;
+    }
+    return n;
+}
+
+// STREAMS A PUT BODY TO DISK ONCE ITS PART FILE IS OPEN: FIRST WHATEVER IS
+// ALREADY BUFFERED, THEN STRAIGHT FROM THE SOCKET IN UPLOAD_CHUNK PIECES.
+// ONCE ALL OF IT IS WRITTEN THE FILE REPLACES THE PART. RETURNS 1 WHEN THE
+// BODY IS COMPLETE, 0 IF THE SOCKET WOULD BLOCK, -1 IF THE CONNECTION CLOSED.
+int pump_upload(struct users const *users, struct connection *c) {
+    usize buffered = c->read.end - c->read.parse_idx;
+    if (buffered > c->upload.remaining) {
+        buffered = c->upload.remaining;
+    }
+    if (buffered > 0) {
+        store_upload(c, &c->read.buf[c->read.parse_idx], buffered);
+        consume_read(c, buffered);
+        c->upload.remaining -= buffered;
+    }
+
+    while (c->upload.remaining > 0) {
+        usize len = c->upload.remaining < UPLOAD_CHUNK ? c->upload.remaining : UPLOAD_CHUNK;
+        isize n;
+        if (c->upload.job->res.fd > 0) {
+            n = splice_upload(c, len);
+        } else {
+            // NOWHERE TO PUT IT, READ AND DISCARD
+            byte scratch[4096];
+            if (len > sizeof(scratch)) {
+                len = sizeof(scratch);
+            }
+            n = read(c->fd, scratch, len);
+        }
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+        c->upload.remaining -= n;
+    }
+
+    TRACE("upload on %d complete", c->fd);
+    struct job *j = c->upload.job;
+    if (j->res.fd > 0 && j->res.status == SUCCESS) {
+        commit_put(user_dir(users, j->user), &j->req, &j->res);
+    }
+    j->state = JOB_DONE;
+    c->upload.job = NULL;
+    c->upload.active = 0;
+    return 1;
+}
+
+// WRITES QUEUED RESPONSES, THEN SENDS ANY GET BODY STRAIGHT FROM THE PAGE
+// CACHE WITH sendfile, UNTIL THE SOCKET WOULD BLOCK. RETURNS 1 IF A GET BODY
+// FINISHED SENDING, SO THE RESPONSES BEHIND IT CAN BE QUEUED, OR IF THE
+// WRITE BACKLOG DROPPED BACK UNDER BUDGET, SO READING CAN RESUME.
+int write_connection(struct event_loop *loop, struct connection *c) {
+    if (c->write.end - c->write.start == 0 && !c->download.job) {
+        return 0;
+    }
+    int backlogged = write_backlogged(c);
+
+    // WRITE UNTIL WOULD BLOCK
+    while (1) {
+        if (c->write.end - c->write.start > 0) {
+            usize wrlen = c->write.end - c->write.start;
+            usize idx = c->write.start;
+            isize nwritten = write(c->fd, &c->write.buf[idx], wrlen);
+            if (nwritten == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    watch_connection(loop, c, EPOLLIN | EPOLLOUT);
+                    return backlogged && !write_backlogged(c);
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                c->hup = 1;
+                return 0;
+            }
+            TRACE("%d <- %zd \"%.*s\"", c->fd, nwritten, 10, c->write.buf);
+            if (nwritten == 0) {
+                return 0;
+            }
+            c->write.start += nwritten;
+            release_write(c);
+            continue;
+        }
+
+        if (c->download.job) {
+            if (c->download.remaining == 0) {
+                TRACE("download on %d complete", c->fd);
+                if (next_download(c)) {
+                    // ANOTHER GET_MULTI PART, ITS HEADER IS IN THE WRITE BUFFER
+                    continue;
+                }
+                watch_connection(loop, c, EPOLLIN);
+                return 1;
+            }
+            usize len = c->download.remaining < DOWNLOAD_CHUNK ? c->download.remaining : DOWNLOAD_CHUNK;
+            isize n = sendfile(c->fd, c->download.fd, &c->download.offset, len);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    watch_connection(loop, c, EPOLLIN | EPOLLOUT);
+                    return backlogged && !write_backlogged(c);
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                c->hup = 1;
+                return 0;
+            }
+            if (n == 0) {
+                // PART SHRANK AFTER THE LENGTH WAS SENT, NO WAY TO RECOVER FRAMING
+                TRACE("part file truncated while sending on %d", c->fd);
+                c->hup = 1;
+                return 0;
+            }
+            TRACE("%d <- sendfile %zd", c->fd, n);
+            c->download.remaining -= n;
+            continue;
+        }
+
+        watch_connection(loop, c, EPOLLIN);
+        return backlogged;
+    }
+}
+
+// MOVES A CONNECTION AS FAR AS IT CAN GO: STREAMS ANY UPLOAD, DISPATCHES
+// BUFFERED REQUESTS AND READS UNTIL THE SOCKET WOULD BLOCK. CALLED ON SOCKET
+// EVENTS AND WHENEVER A WORKER FINISHES ONE OF THE CONNECTION'S JOBS.
+void read_requests(struct event_loop *loop, struct connection *c) {
+    // STOP READING WHILE THE PEER ISN'T TAKING ITS RESPONSES
+    while (!c->hup && !write_backlogged(c)) {
+        if (c->upload.job) {
+            int status = pump_upload(loop->pool->users, c);
+            if (status < 0) {
+                c->hup = 1;
+                break;
+            } else if (status == 0) {
+                break;
+            }
+        }
+
+        int dispatched = dispatch_requests(loop, c);
+        int status = read_connection(c);
+        if (status < 0) {
+            c->hup = 1;
+            break;
+        }
+        dispatched += dispatch_requests(loop, c);
+        if (status == 0) {
+            break;
+        }
+        // READ BUFFER FULL: ONLY WORTH READING AGAIN IF PARSING MADE ROOM.
+        // OTHERWISE WAIT FOR THE PIPELINE TO DRAIN, UNLESS IT'S EMPTY.
+        if (!dispatched) {
+            if (c->pipeline.len == 0 && !c->download.job && !write_backlogged(c)) {
+                TRACE("request on %d doesn't fit in read buffer", c->fd);
+                c->hup = 1;
+            }
+            break;
+        }
+    }
+}
+
+// QUEUES EVERY RESPONSE THAT IS READY BEFORE WRITING, SO PIPELINED
+// RESPONSES LEAVE IN ONE write INSTEAD OF ONE PER REQUEST. ANSWERED REQUESTS
+// LEAVE THE PIPELINE, WHICH MAY LET MORE BUFFERED ONES BE DISPATCHED.
+void service_connection(struct event_loop *loop, struct connection *c) {
+    do {
+        read_requests(loop, c);
+    } while (queue_responses(c) > 0 || (!c->hup && write_connection(loop, c)));
+}
+
+void handle_connection(struct event_loop *loop, struct connection *c, u32 events) {
+    service_connection(loop, c);
+
+    // IF OTHER SIDE NO LONGER READING
+    if ((events & EPOLLRDHUP) || c->hup) {
+        TRACE("%d -> rdhup", c->fd);
+        c->hup = 1;
+        abandon_pipeline(c);
+        if (!c->pending) {
+            close_connection(loop, c);
+        }
+        // OTHERWISE DROPPED ONCE THE WORKERS ARE DONE WITH IT
+    }
+}
+
+// HANDS FINISHED JOBS BACK TO THEIR CONNECTIONS, THEN SERVICES EACH
+// CONNECTION ONCE, SO RESPONSES FINISHED IN THE SAME BATCH ARE WRITTEN
+// TOGETHER.
+void complete_jobs(struct event_loop *loop) {
+    struct connection *ready = NULL;
+    struct job *j = take_completions(&loop->completions);
+    while (j) {
+        struct job *next = j->next;
+        struct connection *c = j->context;
+        c->pending -= 1;
+        if (c->hup) {
+            // ALREADY UNLINKED BY abandon_pipeline
+            drop_job(j);
+            if (!c->pending) {
+                close_connection(loop, c);
+            }
+        } else {
+            if (j->req.type == PUT) {
+                // PART FILE IS OPEN, START STREAMING THE BODY INTO IT
+                j->state = JOB_STREAMING;
+                c->upload.job = j;
+            } else {
+                j->state = JOB_DONE;
+            }
+            if (!c->ready) {
+                c->ready = 1;
+                c->next_ready = ready;
+                ready = c;
+            }
+        }
+        j = next;
+    }
+
+    while (ready) {
+        struct connection *c = ready;
+        ready = c->next_ready;
+        c->ready = 0;
+        c->next_ready = NULL;
+        service_connection(loop, c);
+        if (c->hup) {
+            abandon_pipeline(c);
+            if (!c->pending) {
+                close_connection(loop, c);
+            }
         }
     }
+}
+
+// EACH THREAD RUNS ITS OWN LISTENER, EPOLL INSTANCE AND CONNECTION TABLE.
+// THE KERNEL SHARDS NEW CONNECTIONS ACROSS LISTENERS THROUGH SO_REUSEPORT,
+// SO THE ONLY STATE SHARED BETWEEN THREADS IS THE READ-ONLY USER TABLE.
+// BLOCKING DISK WORK RUNS ON THE SHARED WORKER POOL AND COMES BACK THROUGH
+// THE LOOP'S COMPLETION EVENTFD.
+void *run_event_loop(void *arg) {
+    struct event_loop *loop = arg;
 
     TRACE("starting event loop");
-    struct connection connection_buf[MAX_EVENTS];
-    memset(connection_buf, 0, sizeof(connection_buf));
     struct epoll_event events_buf[MAX_EVENTS];
     while (1) {
-        int num_ready = epoll_wait(epoll, events_buf, MAX_EVENTS, -1);
+        int num_ready = epoll_wait(loop->epoll, events_buf, MAX_EVENTS, -1);
         if (num_ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             TRACE("epoll_wait: %s", system_error());
-            goto cleanup;
+            break;
         }
 
         TRACE("num fds ready: %d", num_ready);
         for (int i = 0; i < num_ready; ++i) {
             u32 events = events_buf[i].events;
-            int event_fd = events_buf[i].data.fd;
-            TRACE("event fd %d, rd %d, wr %d, rdhup %d, hup %d, err %d",
-                  event_fd,
+            u64 handle = events_buf[i].data.u64;
+            TRACE("event %llx, rd %d, wr %d, rdhup %d, hup %d, err %d",
+                  (unsigned long long)handle,
                   events & EPOLLIN ? 1 : 0,
                   events & EPOLLOUT ? 1 : 0,
                   events & EPOLLRDHUP ? 1 : 0,
                   events & EPOLLHUP ? 1 : 0,
                   events & EPOLLERR ? 1: 0);
-            if (event_fd == tcp_listener) {
-                // LOOP ACCEPT
-                while (1) {
-                    // ACCEPT CONNECTION
-                    int connection_fd = accept4(tcp_listener, NULL, NULL, SOCK_CLOEXEC|SOCK_NONBLOCK);
-                    if (connection_fd == -1) {
-                        TRACE("accept4: %s", system_error());
-                        break;
-                    }
-                    // WAIT FOR READ EVENTS ON NEW CONNECTION
-                    struct epoll_event connection_readable = {
-                        .events = EPOLLIN | EPOLLRDHUP | EPOLLET,
-                        .data.fd = connection_fd,
-                    };
-                    err = epoll_ctl(epoll, EPOLL_CTL_ADD, connection_fd, &connection_readable);
-                    if (err != 0) {
-                        TRACE("epoll_ctl: %s", system_error());
-                        close(connection_fd);
-                        continue;
-                    }
-                    // ALLOCATE CONNECTION READ AND WRITE BUFFERS
-                    connection_buf[connection_fd] = (struct connection){
-                        .fd = connection_fd,
-                        .read = {
-                            .buf = malloc(INIT_BUF_LEN),
-                            .parse_idx = 0,
-                            .end = 0,
-                            .capacity = INIT_BUF_LEN,
-                        },
-                        .write = {
-                            .buf = malloc(INIT_BUF_LEN),
-                            .start = 0,
-                            .end = 0,
-                            .capacity = INIT_BUF_LEN,
-                        },
-                    };
-                }
+            if (handle == LISTENER_HANDLE) {
+                accept_connections(loop);
+            } else if (handle == COMPLETIONS_HANDLE) {
+                complete_jobs(loop);
             } else {
-                // HANDLE CONNECTION
-                struct connection *c = &connection_buf[event_fd];
-
-                // IF READABLE
-                if (events & EPOLLIN) {
-                    // READ ALL NEW BYTES
-                    while (1) {
-                        isize n = read(c->fd, &c->read.buf[c->read.end], c->read.capacity - c->read.end);
-                        if (n == -1) {
-                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                                break;
-                            } else if (errno == EINTR) {
-                                continue;
-                            } else {
-                                break;
-                            }
-                        }
-                        TRACE("%d -> %zd", c->fd, n);
-                        if (n == 0) {
-                            events = events | EPOLLRDHUP;
-                            break;
-                        }
-                        c->read.end += n;
-                        // RESIZE READ BUF IF NECESSARY
-                        if (c->read.end == c->read.capacity) {
-                            usize new_cap = c->read.capacity * 2;
-                            c->read.buf = realloc(c->read.buf, new_cap);
-                            c->read.capacity = new_cap;
-                        }
-                    }
-                    TRACE("read.buf parseable content \"%.*s\"",
-                          c->read.end - c->read.parse_idx,
-                          &c->read.buf[c->read.parse_idx]);
+                struct connection *c = slab_get(&loop->connections, handle);
+                if (c) {
+                    handle_connection(loop, c, events);
                 }
+            }
+        }
+    }
 
-                // COPY READABLE TO WRITEABLE ECHO TEST
-                if (c->read.end - c->read.parse_idx >= sizeof(struct request_header)) {
-                    byte const *buf = &c->read.buf[c->read.parse_idx];
-                    usize const len = c->read.end - c->read.parse_idx;
-
-                    assert(memchr(buf, REQUEST_START, len) == buf);
-
-                    struct request_header const *rh = (struct request_header *) buf;
-                    byte const *data = buf + sizeof(struct request_header);
-                    usize data_len = request_data_len(rh);
-
-                    if (len >= sizeof(struct request_header) + data_len) {
-                        // PARSE REQUEST, WRITE RESPONSE TO WRITE BUFFER
-                        struct request r = {0};
-                        r.username = strndup(&data[0], rh->username_len);
-                        r.password = strndup(&data[rh->username_len], rh->password_len);
-
-                        byte const *uniondata = &data[rh->username_len + rh->password_len];
-                        r.type = rh->type;
-                        switch (r.type) {
-                        case PUT:
-                            r.put.path = strndup(&uniondata[0], rh->put.path_len);
-                            r.put.file.buf = malloc(rh->put.file_len);
-                            r.put.file.len = rh->put.file_len;
-                            memcpy(r.put.file.buf, &uniondata[rh->put.path_len], rh->put.file_len);
-                            break;
-                        case GET:
-                            r.get.path = strndup(&uniondata[0], rh->get.path_len);
-                            break;
-                        case LIST:
-                            r.list.path = strndup(&uniondata[0], rh->list.path_len);
-                            break;
-                        case MKDIR:
-                            r.mkdir.path = strndup(&uniondata[0], rh->mkdir.path_len);
-                            break;
-                        default:
-                            TRACE("unknown request type %c", r.type);
-                        }
-                        print_request(&r);
-                        c->read.parse_idx += sizeof(struct request_header) + data_len;
-                        if (c->read.parse_idx == c->read.end) {
-                            TRACE("moving parse and read indices back to start");
-                            c->read.parse_idx = 0;
-                            c->read.end = 0;
-                        }
-
-                        struct response res;
-                        make_response(root_directory, &user, &r, &res);
-                        usize reslen = responselen(&res);
-                        while (c->write.capacity <= c->write.end + reslen) {
-                            usize newcap = c->write.capacity * 2;
-                            c->write.buf = realloc(c->write.buf, newcap);
-                            c->write.capacity = newcap;
-                        }
-                        print_response(&res);
-                        serialize_response(&res, &c->write.buf[c->write.end]);
-                        //TRACE("serialized response: %.*s", reslen, c->write.buf[c->write.end]);
-                        c->write.end += reslen;
-                    }
-                }
+    TRACE("event loop exiting...");
+    return NULL;
+}
 
-                if (c->write.end - c->write.start > 0) {
-                    // WRITE UNTIL WOULD BLOCK
-                    while (1) {
-                        usize wrlen = c->write.end - c->write.start;
-                        usize idx = c->write.start;
-                        isize nwritten = write(c->fd, &c->write.buf[idx], wrlen);
-                        if (nwritten == -1) {
-                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                                struct epoll_event add_writeable = {
-                                    .events = EPOLLIN | EPOLLOUT | EPOLLET,
-                                    .data.fd = c->fd,
-                                };
-                                err = epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &add_writeable);
-                                if (err != 0) {
-                                    TRACE("error adding EPOLLOUT to %d events: %s",
-                                          c->fd, system_error());
-                                }
-                                break;
-                            } else if (errno == EINTR) {
-                                continue;
-                            } else {
-                                break;
-                            }
-                        }
-                        TRACE("%d <- %zd \"%.*s\"", c->fd, nwritten, 10, c->write.buf);
-                        if (nwritten == 0) {
-                            break;
-                        }
-                        c->write.start += nwritten;
-                        if (c->write.end - c->write.start == 0) {
-                            c->write.start = 0;
-                            c->write.end = 0;
-                            struct epoll_event only_readable = {
-                                .events = EPOLLIN | EPOLLET,
-                                .data.fd = c->fd,
-                            };
-                            err = epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &only_readable);
-                            if (err != 0) {
-                                TRACE("error removing EPOLLOUT from %d events: %s",
-                                      c->fd, system_error());
-                            }
-                            break;
-                        }
-                    }
-                }
+int start_event_loop(struct event_loop *loop, char const *port, int reuseport) {
+    init_slab(&loop->connections, sizeof(struct connection));
 
-                // IF OTHER SIDE NO LONGER READING
-                if (events & EPOLLRDHUP) {
-                    TRACE("%d -> rdhup", c->fd);
-                    err = epoll_ctl(epoll, EPOLL_CTL_DEL, c->fd, NULL);
-                    if (err != 0) {
-                        TRACE("error removing %d from epoll", c->fd);
-                    } else {
-                        TRACE("epoll -> %d", c->fd);
-                    }
-                    drop_connection(c);
-                }
+    loop->tcp_listener = make_tcp_listener("127.0.0.1", port, reuseport);
+    if (loop->tcp_listener == -1) {
+        println("error creating tcp listening socket: %s", system_error());
+        return -1;
+    }
+
+    int err = set_nonblocking(loop->tcp_listener, 1);
+    if (err != 0) {
+        println("error making tcp listening socket non-blocking: %s", system_error());
+        return -1;
+    }
+
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll == -1) {
+        println("unable to create epoll instance: %s", system_error());
+        return -1;
+    }
+
+    struct epoll_event accept_event = {
+        .events = EPOLLIN|EPOLLET,
+        .data.u64 = LISTENER_HANDLE,
+    };
+    err = epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->tcp_listener, &accept_event);
+    if (err != 0) {
+        println("error registering listener with epoll: %s\n", system_error());
+        return -1;
+    }
+
+    err = init_completions(&loop->completions);
+    if (err != 0) {
+        println("unable to create completion eventfd: %s", system_error());
+        return -1;
+    }
+
+    struct epoll_event completion_event = {
+        .events = EPOLLIN|EPOLLET,
+        .data.u64 = COMPLETIONS_HANDLE,
+    };
+    err = epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->completions.eventfd, &completion_event);
+    if (err != 0) {
+        println("error registering completion eventfd with epoll: %s", system_error());
+        return -1;
+    }
+
+    err = pthread_create(&loop->thread, NULL, run_event_loop, loop);
+    if (err != 0) {
+        errno = err;
+        println("unable to start event loop thread: %s", system_error());
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char const *const args[]) {
+    struct users users = {0};
+    u64 store_codecs = CODEC_BIT(CODEC_ZLIB);
+    struct event_loop *loops = NULL;
+    struct uring_loop *uring_loops = NULL;
+    int use_uring = 0;
+    struct pool pool = {0};
+    int pool_started = 0;
+    usize num_loops = 1;
+    usize num_workers = DEFAULT_WORKERS;
+    struct buffer_budget budget = {
+        .limit = (usize)DEFAULT_MEMORY_BUDGET_MB << 20,
+        .connection_limit = (usize)DEFAULT_CONNECTION_BUDGET_KB << 10,
+    };
+    usize num_started = 0;
+    char *root_directory = NULL;
+    char *port = NULL;
+
+    if (argc < 3) {
+        println("not enough arguments");
+        println("usage: %s [root directory] [port] [--threads N] [--workers N] [--backend epoll|uring]"
+                " [--memory-budget MB] [--connection-budget KB] [--storage encoded|plain]", args[0]);
+        goto cleanup;
+    }
+
+    root_directory = realpath(args[1], NULL);
+    if (!root_directory) {
+        println("invalid root directory \"%s\": %s", args[1], system_error());
+        goto cleanup;
+    }
+
+    port = strdup(args[2]);
+    if (!is_valid_port(port)) {
+        println("invalid port: %s", port);
+        goto cleanup;
+    }
+
+    for (int i = 3; i < argc; ++i) {
+        if (strings_equal(args[i], "--threads") && i + 1 < argc) {
+            num_loops = strtoul(args[++i], NULL, 10);
+            if (num_loops == 0 || num_loops > MAX_THREADS) {
+                println("invalid thread count: %s", args[i]);
+                goto cleanup;
+            }
+        } else if (strings_equal(args[i], "--backend") && i + 1 < argc) {
+            ++i;
+            if (strings_equal(args[i], "uring")) {
+                use_uring = 1;
+            } else if (!strings_equal(args[i], "epoll")) {
+                println("unknown backend: %s", args[i]);
+                goto cleanup;
+            }
+        } else if (strings_equal(args[i], "--workers") && i + 1 < argc) {
+            num_workers = strtoul(args[++i], NULL, 10);
+            if (num_workers == 0 || num_workers > MAX_WORKERS) {
+                println("invalid worker count: %s", args[i]);
+                goto cleanup;
+            }
+        } else if (strings_equal(args[i], "--memory-budget") && i + 1 < argc) {
+            budget.limit = strtoul(args[++i], NULL, 10) << 20;
+            if (budget.limit == 0) {
+                println("invalid memory budget: %s", args[i]);
+                goto cleanup;
+            }
+        } else if (strings_equal(args[i], "--connection-budget") && i + 1 < argc) {
+            budget.connection_limit = strtoul(args[++i], NULL, 10) << 10;
+            if (budget.connection_limit == 0) {
+                println("invalid connection budget: %s", args[i]);
+                goto cleanup;
+            }
+        } else if (strings_equal(args[i], "--storage") && i + 1 < argc) {
+            ++i;
+            if (strings_equal(args[i], "plain")) {
+                store_codecs = 0;
+            } else if (!strings_equal(args[i], "encoded")) {
+                println("unknown storage: %s", args[i]);
+                goto cleanup;
+            }
+        } else {
+            println("unknown argument: %s", args[i]);
+            goto cleanup;
+        }
+    }
+
+    if (load_users(&users, DFS_CONF, root_directory) != 0) {
+        goto cleanup;
+    }
+    users.store_codecs = store_codecs;
+
+    TRACE("starting dfs: root directory %s, port %s, threads %zu, workers %zu",
+          root_directory, port, num_loops, num_workers);
+
+    raise_fd_limit();
+
+    if (start_pool(&pool, num_workers, &users) != 0) {
+        println("unable to start worker pool: %s", system_error());
+        goto cleanup;
+    }
+    pool_started = 1;
+
+    if (use_uring && !uring_available()) {
+        println("io_uring unavailable (%s), falling back to epoll", system_error());
+        use_uring = 0;
+    }
+
+    if (use_uring) {
+        uring_loops = calloc(num_loops, sizeof(struct uring_loop));
+        for (usize i = 0; i < num_loops; ++i) {
+            uring_loops[i].tcp_listener = -1;
+            uring_loops[i].ring.fd = -1;
+            uring_loops[i].completions.eventfd = -1;
+            uring_loops[i].pool = &pool;
+            init_buffer_pool(&uring_loops[i].buffer_pool, &budget);
+        }
+        for (num_started = 0; num_started < num_loops; ++num_started) {
+            int err = start_uring_loop(&uring_loops[num_started], port, num_loops > 1);
+            if (err != 0) {
+                drop_uring_loop(&uring_loops[num_started]);
+                break;
             }
         }
+    } else {
+        loops = calloc(num_loops, sizeof(struct event_loop));
+        for (usize i = 0; i < num_loops; ++i) {
+            loops[i].tcp_listener = -1;
+            loops[i].epoll = -1;
+            loops[i].completions.eventfd = -1;
+            loops[i].pool = &pool;
+            init_buffer_pool(&loops[i].buffer_pool, &budget);
+        }
+        for (num_started = 0; num_started < num_loops; ++num_started) {
+            int err = start_event_loop(&loops[num_started], port, num_loops > 1);
+            if (err != 0) {
+                close(loops[num_started].tcp_listener);
+                close(loops[num_started].epoll);
+                close(loops[num_started].completions.eventfd);
+                break;
+            }
+        }
+    }
+    if (num_started < num_loops) {
+        panic("started %zu of %zu event loops, exiting", num_started, num_loops);
+    }
+
+    for (usize i = 0; i < num_started; ++i) {
+        pthread_join(use_uring ? uring_loops[i].thread : loops[i].thread, NULL);
+    }
+    if (pool_started) {
+        stop_pool(&pool);
+    }
+    for (usize i = 0; i < num_started; ++i) {
+        if (use_uring) {
+            drop_uring_loop(&uring_loops[i]);
+            continue;
+        }
+        for (usize j = 0; j < loops[i].connections.capacity; ++j) {
+            u64 handle;
+            struct connection *c = slab_entry(&loops[i].connections, j, &handle);
+            if (c) {
+                abandon_pipeline(c);
+                drop_connection(c);
+            }
+        }
+        drop_slab(&loops[i].connections);
+        drop_buffer_pool(&loops[i].buffer_pool);
+        drop_completions(&loops[i].completions);
+        close(loops[i].tcp_listener);
+        close(loops[i].epoll);
     }
 
 cleanup:
     TRACE("exiting...");
-    close(tcp_listener);
-    close(epoll);
+    free(loops);
+    free(uring_loops);
     free(root_directory);
     free(port);
-    for (usize i = 0; i < MAX_EVENTS; ++i) {
-        drop_connection(&connection_buf[i]);
-    }
-    for (usize i = 0; i < user.len; ++i) {
-        free(user.username[i]);
-        free(user.password[i]);
-    }
-    free(user.username);
-    free(user.password);
-    user.len = 0;
-    user.capacity = 0;
+    drop_users(&users);
 }
@@ -13,7 +13,7 @@
 #include <sys/poll.h>
 #include <errno.h>
 
-int make_tcp_listener(char const *ip, char const *port) {
+int make_tcp_listener(char const *ip, char const *port, int reuseport) {
     struct addrinfo *results = NULL;
     {
         struct addrinfo hints;
@@ -42,6 +42,13 @@ int make_tcp_listener(char const *ip, char const *port) {
                 continue;
             }
 
+            if (reuseport) {
+                err = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport));
+                if (err != 0) {
+                    continue;
+                }
+            }
+
             err = bind(fd, r->ai_addr, r->ai_addrlen);
             if (err != 0) {
                 continue;
@@ -106,7 +113,11 @@ int new_tcp_socket() {
     return socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 }
 
-int connect_with_timeout(struct sockaddr_in const *addr, int timeout_ms) {
+// STARTS CONNECTING A NEW NONBLOCKING SOCKET TO addr, SO SEVERAL CONNECTS
+// CAN BE WAITED ON TOGETHER. RETURNS THE SOCKET, WHICH IS READY FOR
+// finish_connect ONCE IT POLLS WRITEABLE, OR -1 IF THE CONNECT FAILED
+// STRAIGHT AWAY.
+int start_connect(struct sockaddr_in const *addr) {
     int fd = new_tcp_socket();
     if (fd == -1) {
         TRACE("new_tcp_socket: %s", system_error());
@@ -122,27 +133,109 @@ int connect_with_timeout(struct sockaddr_in const *addr, int timeout_ms) {
 
     usize addrlen = sizeof(struct sockaddr_in);
     err = connect(fd, addr, addrlen);
-    if (err != 0) {
-        if (errno == EINPROGRESS) {
-            struct pollfd writeable = {
-                .fd = fd,
-                .events = POLLOUT,
-                .revents = 0,
-            };
-            int ready = poll(&writeable, 1, timeout_ms);
-            if (ready == 0) {
-                return CONNECT_TIMEOUT;
-            } else if (writeable.revents & POLLHUP) {
-                return -1;
+    if (err != 0 && errno != EINPROGRESS) {
+        // UNABLE TO CONNECT TO SERVER
+        TRACE("error connecting %s", system_error());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// RETURNS 0 IF THE CONNECT STARTED ON fd SUCCEEDED, -1 IF IT FAILED
+int finish_connect(int fd) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        TRACE("error connecting %s", strerror(err ? err : errno));
+        return -1;
+    }
+    return 0;
+}
+
+int connect_with_timeout(struct sockaddr_in const *addr, int timeout_ms) {
+    int fd = start_connect(addr);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct pollfd writeable = {
+        .fd = fd,
+        .events = POLLOUT,
+        .revents = 0,
+    };
+    int ready = poll(&writeable, 1, timeout_ms);
+    if (ready == 0) {
+        close(fd);
+        return CONNECT_TIMEOUT;
+    }
+    if (ready < 0 || finish_connect(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// WAITS UNTIL fd IS READY FOR events, SO THE *_all HELPERS WORK ON BOTH
+// BLOCKING AND NONBLOCKING SOCKETS
+int wait_ready(int fd, short events) {
+    struct pollfd p = {
+        .fd = fd,
+        .events = events,
+        .revents = 0,
+    };
+    while (poll(&p, 1, -1) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// SENDS ALL len BYTES OF buf. PASS MSG_MORE WHEN ANOTHER SEND FOLLOWS RIGHT
+// AWAY, SO A FRAME AND ITS BODY LEAVE IN THE SAME SEGMENTS.
+int send_all(int fd, void const *buf, usize len, int flags) {
+    byte const *b = buf;
+    usize sent = 0;
+    while (sent < len) {
+        isize n = send(fd, &b[sent], len - sent, flags | MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-            // SHOULD BE WRITEABLE
-            assert(writeable.revents & POLLOUT);
-        } else {
-            // UNABLE TO CONNECT TO SERVER
-            TRACE("error connecting %s", system_error());
+            if (errno == EAGAIN && wait_ready(fd, POLLOUT) == 0) {
+                continue;
+            }
+            TRACE("error writing: %s", system_error());
             return -1;
         }
+        sent += n;
     }
+    return 0;
+}
 
-    return fd;
+// RECEIVES EXACTLY len BYTES INTO buf. RETURNS -1 ON ERROR OR IF THE PEER
+// CLOSES FIRST.
+int recv_all(int fd, void *buf, usize len) {
+    byte *b = buf;
+    usize recvd = 0;
+    while (recvd < len) {
+        isize n = recv(fd, &b[recvd], len - recvd, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && wait_ready(fd, POLLIN) == 0) {
+                continue;
+            }
+            TRACE("error reading: %s", system_error());
+            return -1;
+        }
+        if (n == 0) {
+            TRACE("connection closed with %zu of %zu bytes read", recvd, len);
+            return -1;
+        }
+        recvd += n;
+    }
+    return 0;
 }
@@ -5,10 +5,14 @@
 
 #define CONNECT_TIMEOUT -2
 
-int make_tcp_listener(char const *ip, char const *port);
+int make_tcp_listener(char const *ip, char const *port, int reuseport);
 int set_nonblocking(int fd, int nonblocking);
 int new_tcp_socket();
 int new_sockaddr_in(struct sockaddr_in *a, char const *ip, char const *port);
+int start_connect(struct sockaddr_in const *addr);
+int finish_connect(int fd);
 int connect_with_timeout(struct sockaddr_in const *addr, int timeout_ms);
+int send_all(int fd, void const *buf, size_t len, int flags);
+int recv_all(int fd, void *buf, size_t len);
 
 #endif
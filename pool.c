@@ -0,0 +1,191 @@
+#include "pool.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+void push_job(struct job_queue *q, struct job *j) {
+    j->next = NULL;
+    if (q->tail) {
+        q->tail->next = j;
+    } else {
+        q->head = j;
+    }
+    q->tail = j;
+}
+
+struct job *pop_job(struct job_queue *q) {
+    struct job *j = q->head;
+    if (j) {
+        q->head = j->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        j->next = NULL;
+    }
+    return j;
+}
+
+int is_bulk(struct job const *j) {
+    return j->req.type == PUT || j->req.type == GET || j->req.type == GET_MULTI || j->req.type == GET_RANGE;
+}
+
+void post_completion(struct completions *c, struct job *j) {
+    pthread_mutex_lock(&c->lock);
+    j->next = NULL;
+    if (c->tail) {
+        c->tail->next = j;
+    } else {
+        c->head = j;
+    }
+    c->tail = j;
+    pthread_mutex_unlock(&c->lock);
+
+    uint64_t one = 1;
+    isize n = write(c->eventfd, &one, sizeof(one));
+    if (n != sizeof(one)) {
+        TRACE("error signaling completion: %s", system_error());
+    }
+}
+
+void *run_worker(void *arg) {
+    struct pool *p = arg;
+
+    while (1) {
+        struct job *j = NULL;
+        int bulk = 0;
+
+        pthread_mutex_lock(&p->lock);
+        while (1) {
+            if (p->stopping) {
+                pthread_mutex_unlock(&p->lock);
+                return NULL;
+            }
+            j = pop_job(&p->metadata);
+            if (j) {
+                break;
+            }
+            if (p->running_bulk < p->max_bulk) {
+                j = pop_job(&p->bulk);
+                if (j) {
+                    bulk = 1;
+                    p->running_bulk += 1;
+                    break;
+                }
+            }
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        make_response(p->users, j->user, &j->req, &j->res);
+
+        if (bulk) {
+            pthread_mutex_lock(&p->lock);
+            p->running_bulk -= 1;
+            pthread_cond_broadcast(&p->cond);
+            pthread_mutex_unlock(&p->lock);
+        }
+
+        post_completion(j->completions, j);
+    }
+}
+
+int start_pool(struct pool *p, usize num_workers, struct users const *users) {
+    memset(p, 0, sizeof(struct pool));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    p->users = users;
+    p->max_bulk = num_workers > 1 ? num_workers - 1 : 1;
+    p->workers = calloc(num_workers, sizeof(pthread_t));
+
+    for (p->num_workers = 0; p->num_workers < num_workers; ++p->num_workers) {
+        int err = pthread_create(&p->workers[p->num_workers], NULL, run_worker, p);
+        if (err != 0) {
+            errno = err;
+            TRACE("pthread_create: %s", system_error());
+            stop_pool(p);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void stop_pool(struct pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stopping = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (usize i = 0; i < p->num_workers; ++i) {
+        pthread_join(p->workers[i], NULL);
+    }
+    free(p->workers);
+    p->workers = NULL;
+    p->num_workers = 0;
+
+    for (struct job *j = pop_job(&p->metadata); j; j = pop_job(&p->metadata)) {
+        drop_job(j);
+    }
+    for (struct job *j = pop_job(&p->bulk); j; j = pop_job(&p->bulk)) {
+        drop_job(j);
+    }
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+}
+
+void submit_job(struct pool *p, struct job *j) {
+    pthread_mutex_lock(&p->lock);
+    push_job(is_bulk(j) ? &p->bulk : &p->metadata, j);
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+int init_completions(struct completions *c) {
+    memset(c, 0, sizeof(struct completions));
+    c->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (c->eventfd == -1) {
+        return -1;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    return 0;
+}
+
+void drop_completions(struct completions *c) {
+    if (c) {
+        for (struct job *j = take_completions(c); j;) {
+            struct job *next = j->next;
+            drop_job(j);
+            j = next;
+        }
+        close(c->eventfd);
+        pthread_mutex_destroy(&c->lock);
+        memset(c, 0, sizeof(struct completions));
+    }
+}
+
+// TAKES EVERY FINISHED JOB AT ONCE, OLDEST FIRST, LINKED THROUGH next.
+struct job *take_completions(struct completions *c) {
+    uint64_t count;
+    while (read(c->eventfd, &count, sizeof(count)) == sizeof(count)) {
+        // DRAIN EVENTFD SO EDGE-TRIGGERED EPOLL FIRES AGAIN
+    }
+
+    pthread_mutex_lock(&c->lock);
+    struct job *j = c->head;
+    c->head = NULL;
+    c->tail = NULL;
+    pthread_mutex_unlock(&c->lock);
+    return j;
+}
+
+void drop_job(struct job *j) {
+    if (j) {
+        drop_request(&j->req);
+        drop_response(&j->res);
+        free(j);
+    }
+}
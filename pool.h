@@ -0,0 +1,71 @@
+#ifndef pool_h
+#define pool_h
+#include "typedefs.h"
+#include "request.h"
+#include "response.h"
+#include "users.h"
+#include <pthread.h>
+
+// A REQUEST HANDED FROM AN EVENT LOOP TO THE WORKER POOL. THE WORKER FILLS IN
+// res AND POSTS THE JOB BACK TO THE SUBMITTING LOOP'S COMPLETION QUEUE.
+enum job_state {
+    // HELD BY A WORKER
+    JOB_RUNNING,
+    // BACK ON THE EVENT LOOP, PUT BODY STILL STREAMING INTO THE PART FILE
+    JOB_STREAMING,
+    // READY TO BE ANSWERED
+    JOB_DONE,
+};
+
+struct job {
+    struct job *next;
+    struct completions *completions;
+    void *context;
+    // NEXT REQUEST FROM THE SAME CONNECTION
+    struct job *pipeline_next;
+    enum job_state state;
+    // WHO THE REQUEST RUNS AS, NULL IF ITS CREDENTIALS DIDN'T CHECK OUT
+    struct user *user;
+    struct request req;
+    struct response res;
+};
+
+// FINISHED JOBS WAITING FOR AN EVENT LOOP. WORKERS SIGNAL eventfd AFTER
+// APPENDING, SO THE LOOP CAN WAIT ON IT WITH THE REST OF ITS FDS.
+struct completions {
+    pthread_mutex_t lock;
+    struct job *head;
+    struct job *tail;
+    int eventfd;
+};
+
+struct job_queue {
+    struct job *head;
+    struct job *tail;
+};
+
+// FIXED SET OF WORKER THREADS RUNNING make_response. PUT/GET ARE QUEUED AS
+// BULK JOBS AND AT MOST max_bulk OF THEM RUN AT ONCE, SO A WORKER IS ALWAYS
+// LEFT FOR LIST/MKDIR WHILE LARGE TRANSFERS ARE IN FLIGHT.
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct job_queue metadata;
+    struct job_queue bulk;
+    usize running_bulk;
+    usize max_bulk;
+    usize num_workers;
+    pthread_t *workers;
+    int stopping;
+    struct users const *users;
+};
+
+int start_pool(struct pool *p, usize num_workers, struct users const *users);
+void stop_pool(struct pool *p);
+void submit_job(struct pool *p, struct job *j);
+int init_completions(struct completions *c);
+void drop_completions(struct completions *c);
+struct job *take_completions(struct completions *c);
+void drop_job(struct job *j);
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/socket.h>
 
 usize request_data_len(struct request_header const *rh) {
     usize userpass_len = rh->username_len + rh->password_len;
@@ -34,26 +35,328 @@ usize request_data_len(struct request_header const *rh) {
     return userpass_len + data_len;
 }
 
+int known_request_type(byte type) {
+    return type == PUT || type == GET || type == LIST || type == MKDIR || type == GET_MULTI || type == GET_RANGE || type == LOGIN || type == STAT;
+}
+
+char const *request_path(struct request const *r) {
+    switch (r->type) {
+    case PUT:
+        return r->put.path;
+    case GET:
+        return r->get.path;
+    case LIST:
+        return r->list.path;
+    case MKDIR:
+        return r->mkdir.path;
+    case GET_RANGE:
+        return r->get_range.path;
+    }
+    return "";
+}
+
+void set_request_path(struct request *r, char *path) {
+    switch (r->type) {
+    case PUT:
+        r->put.path = path;
+        break;
+    case GET:
+        r->get.path = path;
+        break;
+    case LIST:
+        r->list.path = path;
+        break;
+    case MKDIR:
+        r->mkdir.path = path;
+        break;
+    case GET_RANGE:
+        r->get_range.path = path;
+        break;
+    }
+}
+
+// GET_MULTI AND STAT CARRY A count AND count PATHS INSTEAD OF ONE PATH
+usize path_list_len(char *const *paths, usize count) {
+    usize len = varint_len(count);
+    for (usize i = 0; i < count; ++i) {
+        len += string_len(strlen(paths[i]));
+    }
+    return len;
+}
+
+void put_path_list(struct wire_writer *w, char *const *paths, usize count) {
+    put_varint(w, count);
+    for (usize i = 0; i < count; ++i) {
+        put_string(w, paths[i], strlen(paths[i]));
+    }
+}
+
+// RETURNS THE PATHS OF A PATH LIST, HOWEVER MANY COULD BE READ, AND STORES
+// THEIR NUMBER IN count. A LIST LONGER THAN GET_MULTI_MAX IS AN ERROR.
+char **get_path_list(struct wire_reader *rd, usize *count) {
+    usize len = get_varint(rd);
+    if (len > GET_MULTI_MAX) {
+        rd->error = 1;
+        len = 0;
+    }
+    char **paths = calloc(len > 0 ? len : 1, sizeof(char *));
+    *count = 0;
+    for (usize i = 0; i < len && !rd->error; ++i) {
+        paths[i] = get_string(rd);
+        *count += 1;
+    }
+    return paths;
+}
+
+usize request_body_len(struct request const *r) {
+    usize len = string_len(strlen(r->username)) + string_len(strlen(r->password));
+    if (r->tagged) {
+        len += varint_len(r->id);
+    }
+    if (r->type == GET_MULTI) {
+        len += path_list_len(r->get_multi.paths, r->get_multi.count);
+        return len + optionals_len((u64 const[]){ r->get_multi.accept, r->get_multi.flags }, 2);
+    }
+    if (r->type == STAT) {
+        return len + path_list_len(r->stat.paths, r->stat.count);
+    }
+    if (r->type == LOGIN) {
+        return len;
+    }
+    len += string_len(strlen(request_path(r)));
+    if (r->type == PUT) {
+        len += varint_len(r->put.file.len) + optionals_len((u64 const[]){ r->put.codec, r->put.checksum, r->put.plain_len }, 3);
+    } else if (r->type == GET) {
+        len += optionals_len((u64 const[]){ r->get.accept, r->get.flags }, 2);
+    } else if (r->type == LIST) {
+        len += varint_len(r->list.flags) + varint_len(r->list.cursor) + varint_len(r->list.limit);
+    } else if (r->type == GET_RANGE) {
+        len += varint_len(r->get_range.offset) + varint_len(r->get_range.length);
+    }
+    return len;
+}
+
+// LENGTH OF THE V2 FRAME FOR r, NOT COUNTING A PUT'S BODY
+usize request_frame_len(struct request const *r) {
+    usize body_len = request_body_len(r);
+    return 2 + varint_len(body_len) + body_len;
+}
+
+// WRITES THE V2 FRAME FOR r INTO buf, WHICH MUST HOLD request_frame_len
+// BYTES, AND RETURNS ITS LENGTH. A PUT'S BODY IS LEFT FOR THE CALLER TO SEND.
+usize serialize_request(struct request const *r, byte *buf) {
+    struct wire_writer w = { buf };
+    put_byte(&w, WIRE_START_V2);
+    put_byte(&w, r->tagged ? r->type | REQUEST_TAGGED : r->type);
+    put_varint(&w, request_body_len(r));
+    if (r->tagged) {
+        put_varint(&w, r->id);
+    }
+    put_string(&w, r->username, strlen(r->username));
+    put_string(&w, r->password, strlen(r->password));
+    if (r->type == GET_MULTI) {
+        put_path_list(&w, r->get_multi.paths, r->get_multi.count);
+        put_optionals(&w, (u64 const[]){ r->get_multi.accept, r->get_multi.flags }, 2);
+        return w.p - buf;
+    }
+    if (r->type == STAT) {
+        put_path_list(&w, r->stat.paths, r->stat.count);
+        return w.p - buf;
+    }
+    if (r->type == LOGIN) {
+        return w.p - buf;
+    }
+    char const *path = request_path(r);
+    put_string(&w, path, strlen(path));
+    if (r->type == PUT) {
+        put_varint(&w, r->put.file.len);
+        put_optionals(&w, (u64 const[]){ r->put.codec, r->put.checksum, r->put.plain_len }, 3);
+    } else if (r->type == GET) {
+        put_optionals(&w, (u64 const[]){ r->get.accept, r->get.flags }, 2);
+    } else if (r->type == LIST) {
+        put_varint(&w, r->list.flags);
+        put_varint(&w, r->list.cursor);
+        put_varint(&w, r->list.limit);
+    } else if (r->type == GET_RANGE) {
+        put_varint(&w, r->get_range.offset);
+        put_varint(&w, r->get_range.length);
+    }
+    return w.p - buf;
+}
+
+// PARSES A V1 REQUEST AT THE START OF buf. RETURNS 1 AND STORES THE BYTES IT
+// TOOK IN frame_len IF A WHOLE REQUEST WAS PARSED INTO r, 0 IF MORE BYTES ARE
+// NEEDED, -1 IF THE REQUEST IS MALFORMED. A PUT'S BODY ISN'T PART OF THE
+// FRAME AND IS LEFT IN buf.
+int parse_request_v1(byte const *buf, usize len, struct request *r, usize *frame_len) {
+    if (len < sizeof(struct request_header)) {
+        return 0;
+    }
+
+    struct request_header rh;
+    memcpy(&rh, buf, sizeof(struct request_header));
+    if (rh.start != REQUEST_START || !known_request_type(rh.type) || rh.type == GET_MULTI || rh.type == GET_RANGE || rh.type == LOGIN || rh.type == STAT) {
+        TRACE("malformed v1 request header");
+        return -1;
+    }
+    // THE FRAME IS THE USERNAME, PASSWORD AND PATH, EVERY TYPE KEEPING ITS
+    // path_len IN THE SAME PLACE. EACH LENGTH IS CHECKED ON ITS OWN FIRST, SO
+    // NO SUM OF THEM CAN WRAP AROUND AND NO OFFSET BUILT FROM THEM LEAVES buf.
+    // A PUT'S file_len ISN'T PART OF THE FRAME AND CAN BE ANY SIZE.
+    if (rh.username_len > REQUEST_FRAME_MAX || rh.password_len > REQUEST_FRAME_MAX
+        || rh.get.path_len > REQUEST_FRAME_MAX)
+    {
+        TRACE("v1 request field too long");
+        return -1;
+    }
+    usize data_len = rh.username_len + rh.password_len + rh.get.path_len;
+    if (data_len > REQUEST_FRAME_MAX) {
+        TRACE("v1 request too long: %zu bytes", data_len);
+        return -1;
+    }
+    if (len < sizeof(struct request_header) + data_len) {
+        return 0;
+    }
+
+    char const *data = (char const *)buf + sizeof(struct request_header);
+    memset(r, 0, sizeof(struct request));
+    r->version = WIRE_V1;
+    r->type = rh.type;
+    r->username = strndup(&data[0], rh.username_len);
+    r->password = strndup(&data[rh.username_len], rh.password_len);
+    set_request_path(r, strndup(&data[rh.username_len + rh.password_len], rh.get.path_len));
+    if (r->type == PUT) {
+        r->put.file.len = rh.put.file_len;
+    }
+
+    *frame_len = sizeof(struct request_header) + data_len;
+    return 1;
+}
+
+// PARSES A V2 REQUEST FRAME AT THE START OF buf, RETURNING AS parse_request_v1
+int parse_request_v2(byte const *buf, usize len, struct request *r, usize *frame_len) {
+    if (len < 3) {
+        return 0;
+    }
+    if (buf[0] != WIRE_START_V2 || !known_request_type(buf[1] & ~REQUEST_TAGGED)) {
+        TRACE("malformed v2 request frame");
+        return -1;
+    }
+
+    u64 body_len;
+    usize varint_bytes;
+    int ok = peek_varint(&buf[2], len - 2, &body_len, &varint_bytes);
+    if (ok <= 0) {
+        return ok;
+    }
+    if (body_len > REQUEST_FRAME_MAX) {
+        TRACE("v2 request too long: %llu bytes", (unsigned long long)body_len);
+        return -1;
+    }
+    usize header_len = 2 + varint_bytes;
+    if (len < header_len + body_len) {
+        return 0;
+    }
+
+    struct wire_reader rd = { &buf[header_len], &buf[header_len + body_len], 0 };
+    memset(r, 0, sizeof(struct request));
+    r->version = WIRE_V2;
+    r->type = buf[1] & ~REQUEST_TAGGED;
+    if (buf[1] & REQUEST_TAGGED) {
+        r->tagged = 1;
+        r->id = get_varint(&rd);
+    }
+    r->username = get_string(&rd);
+    r->password = get_string(&rd);
+    if (r->type == GET_MULTI) {
+        r->get_multi.paths = get_path_list(&rd, &r->get_multi.count);
+        r->get_multi.accept = get_optional(&rd);
+        r->get_multi.flags = get_optional(&rd);
+    } else if (r->type == STAT) {
+        r->stat.paths = get_path_list(&rd, &r->stat.count);
+    } else if (r->type != LOGIN) {
+        set_request_path(r, get_string(&rd));
+    }
+    if (r->type == PUT) {
+        r->put.file.len = get_varint(&rd);
+        r->put.codec = get_optional(&rd);
+        r->put.checksum = get_optional(&rd);
+        r->put.plain_len = get_optional(&rd);
+    } else if (r->type == GET) {
+        r->get.accept = get_optional(&rd);
+        r->get.flags = get_optional(&rd);
+    } else if (r->type == LIST) {
+        r->list.flags = get_optional(&rd);
+        r->list.cursor = get_optional(&rd);
+        r->list.limit = get_optional(&rd);
+        if (r->list.limit == 0) {
+            r->list.limit = LIST_PAGE_DEFAULT;
+        }
+        if (r->list.limit > LIST_PAGE_MAX) {
+            r->list.limit = LIST_PAGE_MAX;
+        }
+    } else if (r->type == GET_RANGE) {
+        r->get_range.offset = get_varint(&rd);
+        r->get_range.length = get_varint(&rd);
+    }
+    if (rd.error) {
+        TRACE("truncated v2 request frame");
+        drop_request(r);
+        return -1;
+    }
+
+    *frame_len = header_len + body_len;
+    return 1;
+}
+
 void print_request(struct request const *r) {
     println("username %s", r->username);
     println("password %s", r->password);
     println("type %c", r->type);
+    if (r->tagged) {
+        println("id %llu", (unsigned long long)r->id);
+    }
     switch (r->type) {
     case PUT:
         println("path %s", r->put.path);
-        print("file \"");
-        print_escaped(r->put.file.buf, r->put.file.len);
-        println("\"");
+        if (r->put.file.buf) {
+            print("file \"");
+            print_escaped(r->put.file.buf, r->put.file.len);
+            println("\"");
+        } else {
+            println("file %zu bytes", r->put.file.len);
+        }
+        println("codec %llu", (unsigned long long)r->put.codec);
+        if (r->put.checksum) {
+            println("crc32c %08x", (u32)r->put.checksum);
+        }
         break;
     case GET:
         println("path %s", r->get.path);
         break;
     case LIST:
         println("path %s", r->list.path);
+        println("flags %llx cursor %llx limit %llu", (unsigned long long)r->list.flags,
+                (unsigned long long)r->list.cursor, (unsigned long long)r->list.limit);
         break;
     case MKDIR:
         println("path %s", r->mkdir.path);
         break;
+    case GET_MULTI:
+        for (usize i = 0; i < r->get_multi.count; ++i) {
+            println("path %s", r->get_multi.paths[i]);
+        }
+        break;
+    case STAT:
+        for (usize i = 0; i < r->stat.count; ++i) {
+            println("path %s", r->stat.paths[i]);
+        }
+        break;
+    case GET_RANGE:
+        println("path %s", r->get_range.path);
+        println("offset %llu length %llu", (unsigned long long)r->get_range.offset,
+                (unsigned long long)r->get_range.length);
+        break;
     }
 }
 
@@ -82,9 +385,11 @@ int request_from_string(struct request *r, char const *s) {
         char *path = strdup(token);
         char *filename = take_filename(path);
 
-        int err = read_file(path, &r->put.file.buf, &r->put.file.len);
-        if (err != 0) {
+        // THE FILE IS ONLY READ ONCE THE PUT RUNS, A SLICE AT A TIME
+        if (access(path, R_OK) != 0) {
             TRACE("unable to read file \"%s\"", path);
+            free(path);
+            free(filename);
             goto invalid;
         }
 
@@ -97,8 +402,8 @@ int request_from_string(struct request *r, char const *s) {
         }
 
         r->put.path = join_paths(dir, filename);
+        r->put.source = path;
 
-        free(path);
         free(filename);
         free(dir);
         return 0;
@@ -110,7 +415,39 @@ int request_from_string(struct request *r, char const *s) {
         if (!token) {
             goto invalid;
         }
-        r->get.path = strdup(token);
+        char *path = token;
+
+        // get <path> <offset> <length> READS JUST THAT WINDOW OF THE FILE
+        token = strtok_r(NULL, " ", &save);
+        if (token) {
+            char *end;
+            r->type = GET_RANGE;
+            r->get_range.offset = strtoull(token, &end, 10);
+            if (*end != '\0') {
+                goto invalid;
+            }
+            token = strtok_r(NULL, " ", &save);
+            if (!token) {
+                goto invalid;
+            }
+            r->get_range.length = strtoull(token, &end, 10);
+            if (*end != '\0') {
+                goto invalid;
+            }
+        }
+        set_request_path(r, strdup(path));
+        return 0;
+    }
+
+    if (strings_equal(token, "STAT")) {
+        r->type = STAT;
+        token = strtok_r(NULL, " ", &save);
+        if (!token) {
+            goto invalid;
+        }
+        r->stat.paths = malloc(sizeof(char *));
+        r->stat.paths[0] = strdup(token);
+        r->stat.count = 1;
         return 0;
     }
 
@@ -138,6 +475,7 @@ void drop_request(struct request *r) {
         case PUT:
             free(r->put.path);
             free(r->put.file.buf);
+            free(r->put.source);
             break;
         case GET:
             free(r->get.path);
@@ -148,84 +486,108 @@ void drop_request(struct request *r) {
         case MKDIR:
             free(r->mkdir.path);
             break;
+        case GET_MULTI:
+            for (usize i = 0; i < r->get_multi.count; ++i) {
+                free(r->get_multi.paths[i]);
+            }
+            free(r->get_multi.paths);
+            break;
+        case GET_RANGE:
+            free(r->get_range.path);
+            break;
+        case STAT:
+            for (usize i = 0; i < r->stat.count; ++i) {
+                free(r->stat.paths[i]);
+            }
+            free(r->stat.paths);
+            break;
         }
         memset(r, 0, sizeof(struct request));
     }
 }
 
-int send_get_request(int fd, char const *username, char const *password, char const *path) {
-    set_nonblocking(fd, 0);
-    struct request_header header = {0};
-    header.start = REQUEST_START;
-    header.type = GET;
-    header.username_len = strlen(username);
-    header.password_len = strlen(password);
-    header.get.path_len = strlen(path);
-
-    byte const *b = (byte *)(&header);
-    usize len = sizeof(struct request_header);
-
-    { // WRITE REQUEST HEADER
-        usize sent = 0;
-        while (sent < len) {
-            isize n = write(fd, &b[sent], len - sent);
-            if (n == -1) {
-                TRACE("error writing: %s", system_error());
-                continue;
-            }
-            sent += n;
-        }
-    }
-    { // WRITE REQUEST DATA
-        assert(write(fd, username, header.username_len) == header.username_len);
-        assert(write(fd, password, header.password_len) == header.password_len);
-        assert(write(fd, path, header.get.path_len) == header.get.path_len);
+// SENDS THE V2 FRAME FOR r, FOLLOWED BY ITS BODY FOR A PUT
+int send_request(int fd, struct request const *r) {
+    usize len = request_frame_len(r);
+    byte *frame = malloc(len);
+    serialize_request(r, frame);
+
+    // A PUT WITHOUT file.buf HAS ITS BODY STREAMED BY THE CALLER NEXT
+    int has_body = r->type == PUT && r->put.file.len > 0;
+    int err = send_all(fd, frame, len, has_body ? MSG_MORE : 0);
+    if (err == 0 && has_body && r->put.file.buf) {
+        err = send_all(fd, r->put.file.buf, r->put.file.len, 0);
     }
 
-    set_nonblocking(fd, 1);
-    return 0;
+    free(frame);
+    return err;
 }
 
-int send_list_request(int fd, char const *username, char const *password, char const *path) {
-    set_nonblocking(fd, 0);
-    struct request_header header = {0};
-    header.start = REQUEST_START;
-    header.type = LIST;
-    header.username_len = strlen(username);
-    header.password_len = strlen(password);
-    header.list.path_len = strlen(path);
+void init_path_request(struct request *r, byte type, char const *username, char const *password, char const *path) {
+    memset(r, 0, sizeof(struct request));
+    r->username = (char *)username;
+    r->password = (char *)password;
+    r->type = type;
+    set_request_path(r, (char *)path);
+}
 
-    { // WRITE REQUEST HEADER
-        isize n = write(fd, &header, sizeof(struct request_header));
-        assert(n == sizeof(struct request_header));
-    }
-    { // WRITE REQUEST DATA
-        assert(write(fd, username, header.username_len) == header.username_len);
-        assert(write(fd, password, header.password_len) == header.password_len);
-        assert(write(fd, path, header.list.path_len) == header.list.path_len);
-    }
-    set_nonblocking(fd, 1);
-    return 0;
+int send_path_request(int fd, byte type, char const *username, char const *password, char const *path) {
+    struct request r;
+    init_path_request(&r, type, username, password, path);
+    return send_request(fd, &r);
+}
+
+int send_get_request(int fd, char const *username, char const *password, char const *path) {
+    return send_path_request(fd, GET, username, password, path);
+}
+
+int send_list_request(int fd, char const *username, char const *password, char const *path, u64 flags, u64 cursor, u64 limit) {
+    struct request r;
+    init_path_request(&r, LIST, username, password, path);
+    r.list.flags = flags;
+    r.list.cursor = cursor;
+    r.list.limit = limit;
+    return send_request(fd, &r);
 }
 
 int send_mkdir_request(int fd, char const *username, char const *password, char const *path) {
-    set_nonblocking(fd, 0);
-    struct request_header header = {0};
-    header.start = REQUEST_START;
-    header.type = MKDIR;
-    header.username_len = strlen(username);
-    header.password_len = strlen(password);
-    header.mkdir.path_len = strlen(path);
+    return send_path_request(fd, MKDIR, username, password, path);
+}
 
-    {
-        isize n = write(fd, &header, sizeof(struct request_header));
-        assert(n == sizeof(struct request_header));
-    }
-    {
-        assert(write(fd, username, header.username_len) == header.username_len);
-        assert(write(fd, password, header.password_len) == header.password_len);
-        assert(write(fd, path, header.mkdir.path_len) == header.mkdir.path_len);
-    }
-    set_nonblocking(fd, 1);
-    return 0;
+int send_get_multi_request(int fd, char const *username, char const *password, char **paths, usize count, u64 accept, u64 flags) {
+    struct request r = {0};
+    r.username = (char *)username;
+    r.password = (char *)password;
+    r.type = GET_MULTI;
+    r.get_multi.paths = paths;
+    r.get_multi.count = count;
+    r.get_multi.accept = accept;
+    r.get_multi.flags = flags;
+    return send_request(fd, &r);
+}
+
+int send_login_request(int fd, char const *username, char const *password) {
+    struct request r = {0};
+    r.username = (char *)username;
+    r.password = (char *)password;
+    r.type = LOGIN;
+    return send_request(fd, &r);
+}
+
+int send_stat_request(int fd, char const *username, char const *password, char **paths, usize count) {
+    struct request r = {0};
+    r.username = (char *)username;
+    r.password = (char *)password;
+    r.type = STAT;
+    r.stat.paths = paths;
+    r.stat.count = count;
+    return send_request(fd, &r);
+}
+
+int send_get_range_request(int fd, char const *username, char const *password, char const *path, u64 offset, u64 length) {
+    struct request r;
+    init_path_request(&r, GET_RANGE, username, password, path);
+    r.get_range.offset = offset;
+    r.get_range.length = length;
+    return send_request(fd, &r);
 }
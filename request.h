@@ -1,16 +1,84 @@
 #ifndef request_h
 #define request_h
 #include "typedefs.h"
+#include "wire.h"
+#include "codec.h"
+#include "crc32c.h"
 
 // START
 #define REQUEST_START   'R'
+// LIST FLAGS
+#define LIST_METADATA   0x1
+// SET ON A RESPONSE WHOSE cursor CONTINUES THE LISTING
+#define LIST_MORE       0x2
+// GET AND GET_MULTI FLAGS
+#define GET_CHECKSUMS   0x1
+
+// ENTRIES PER LIST PAGE WHEN A V2 REQUEST ASKS FOR 0, AND THE MOST IT MAY ASK FOR
+#define LIST_PAGE_DEFAULT   1024
+#define LIST_PAGE_MAX       16384
+
+// LONGEST V2 REQUEST FRAME ACCEPTED, NOT COUNTING A PUT'S BODY
+#define REQUEST_FRAME_MAX   8192
 
 // TYPE
 #define PUT         'P'
 #define GET         'G'
 #define LIST        'L'
 #define MKDIR       'M'
+#define GET_MULTI   'B'
+#define GET_RANGE   'R'
+#define LOGIN       'A'
+#define STAT        'S'
+// SET ON THE TYPE BYTE OF A V2 FRAME THAT CARRIES A REQUEST ID
+#define REQUEST_TAGGED  0x80
+
+// MOST PATHS ONE GET_MULTI OR STAT MAY ASK FOR
+#define GET_MULTI_MAX   16
 
+// V1 REQUESTS START WITH THIS FIXED 40 BYTE HEADER IN HOST BYTE ORDER,
+// FOLLOWED BY THE USERNAME, PASSWORD AND PATH BYTES (AND A PUT'S BODY).
+//
+// V2 REQUESTS ARE A FRAME OF LITTLE-ENDIAN BASE-128 VARINTS AND STRINGS,
+// WHERE A STRING IS A VARINT LENGTH FOLLOWED BY THAT MANY BYTES:
+//
+//     WIRE_START_V2 type frame_len username password path [file_len [codec [checksum [plain_len]]]]
+//     WIRE_START_V2 type frame_len username password path [accept [flags]]
+//     WIRE_START_V2 type frame_len username password path [flags cursor limit]
+//     WIRE_START_V2 type frame_len username password path [offset length]
+//
+// GET_MULTI (V2 ONLY) REPLACES path WITH A count AND count PATHS:
+//
+//     WIRE_START_V2 type frame_len username password count path... [accept [flags]]
+//
+// AS DOES STAT (V2 ONLY), WHICH HAS NOTHING AFTER ITS PATHS:
+//
+//     WIRE_START_V2 STAT frame_len username password count path...
+//
+// LOGIN (V2 ONLY) HAS NO path, AND MAKES ITS USER THE CONNECTION'S SESSION
+// USER. LATER REQUESTS ON THE CONNECTION MAY THEN SEND AN EMPTY username AND
+// password TO RUN AS THE SESSION USER:
+//
+//     WIRE_START_V2 LOGIN frame_len username password
+//
+// A TAGGED REQUEST SETS REQUEST_TAGGED IN type AND STARTS ITS FRAME WITH A
+// VARINT id, WHICH ITS RESPONSE ECHOES (SEE response.h):
+//
+//     WIRE_START_V2 type|REQUEST_TAGGED frame_len id username password ...
+//
+// frame_len COUNTS THE BYTES AFTER IT. file_len IS ONLY PRESENT FOR PUT, AND
+// THAT MANY BODY BYTES FOLLOW THE FRAME, ENCODED WITH codec (SEE codec.h),
+// WHICH IS ALSO HOW THE PART IS STORED. checksum IS THE CRC32C OF THE PLAIN
+// PART (SEE crc32c.h), WHICH IS STORED WITH IT AND RETURNED BY GET, AND
+// plain_len THE LENGTH AN ENCODED BODY DECODES TO, WHICH STAT RETURNS.
+// accept IS ONLY PRESENT FOR GET AND GET_MULTI, AND HAS A CODEC_BIT FOR
+// EVERY CODEC THE CLIENT CAN DECODE, AND MAY BE FOLLOWED BY flags, WHERE
+// GET_CHECKSUMS ASKS FOR THE checksum OF EVERY PART. cursor AND limit ARE
+// ONLY PRESENT FOR LIST, AND ANY OF ITS FIELDS MAY BE LEFT OFF THE END,
+// MEANING 0: THE FIRST PAGE OF LIST_PAGE_DEFAULT ENTRIES WITHOUT METADATA.
+// offset AND length ARE ONLY PRESENT FOR GET_RANGE (V2 ONLY), AND SELECT
+// BYTES OF ONE PART FILE. PARSERS SKIP ANY BYTES LEFT IN THE FRAME AFTER THE
+// FIELDS THEY KNOW, SO FIELDS CAN BE ADDED AT THE END.
 struct request_header {
     byte start;
     byte type;
@@ -41,35 +109,84 @@ struct request {
     char *username;
     char *password;
     byte type;
+    // WIRE VERSION THE REQUEST ARRIVED IN, AND THE ONE ITS RESPONSE USES
+    byte version;
+    // SET IF THE REQUEST CARRIES id, IN WHICH CASE ITS RESPONSE MAY OVERTAKE
+    // THE RESPONSES TO REQUESTS SENT BEFORE IT
+    byte tagged;
+    u64 id;
     union {
         struct {
             char *path;
+            // THE BODY. A CLIENT LEAVES buf NULL AND STREAMS THE len BYTES
+            // ITSELF, FROM THE LOCAL FILE AT source.
             struct {
                 byte *buf;
                 usize len;
             } file;
+            char *source;
+            u64 codec;
+            u64 checksum;
+            u64 plain_len;
         } put;
 
         struct {
             char *path;
+            u64 accept;
+            u64 flags;
         } get;
 
         struct {
             char *path;
+            u64 flags;
+            // WHERE TO RESUME, FROM THE cursor OF THE PREVIOUS PAGE. 0 STARTS
+            // FROM THE BEGINNING.
+            u64 cursor;
+            u64 limit;
         } list;
 
         struct {
             char *path;
         } mkdir;
+
+        struct {
+            char **paths;
+            usize count;
+            u64 accept;
+            u64 flags;
+        } get_multi;
+
+        struct {
+            char *path;
+            u64 offset;
+            u64 length;
+        } get_range;
+
+        struct {
+            char **paths;
+            usize count;
+        } stat;
     };
 };
 
 usize request_data_len(struct request_header const *rh);
+int known_request_type(byte type);
+char const *request_path(struct request const *r);
+usize request_frame_len(struct request const *r);
+usize serialize_request(struct request const *r, byte *buf);
+int parse_request_v1(byte const *buf, usize len, struct request *r, usize *frame_len);
+int parse_request_v2(byte const *buf, usize len, struct request *r, usize *frame_len);
+int send_request(int fd, struct request const *r);
+void init_path_request(struct request *r, byte type, char const *username, char const *password, char const *path);
 void print_request(struct request const *r);
 int request_from_string(struct request *r, char const *s);
 void drop_request(struct request *r);
 int send_get_request(int fd, char const *username, char const *password, char const *path);
-int send_list_request(int fd, char const *username, char const *password, char const *path);
+int send_list_request(int fd, char const *username, char const *password, char const *path, u64 flags, u64 cursor, u64 limit);
 int send_mkdir_request(int fd, char const *username, char const *password, char const *path);
+int send_get_multi_request(int fd, char const *username, char const *password, char **paths, usize count, u64 accept, u64 flags);
+int send_login_request(int fd, char const *username, char const *password);
+int send_stat_request(int fd, char const *username, char const *password, char **paths, usize count);
+int send_get_range_request(int fd, char const *username, char const *password, char const *path, u64 offset, u64 length);
 
 #endif
@@ -12,126 +12,410 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <fcntl.h>
 
-usize responselen(struct response const *res) {
-    usize len = sizeof(struct response_header);
+// SAYS WHETHER A RESPONSE OF THIS TYPE IS FOLLOWED BY get.file.len BYTES
+int has_get_body(byte type) {
+    return type == GET || type == GET_RANGE;
+}
 
-    switch (res->type) {
-    case PUT:
-        break;
-    case GET:
-        len += res->get.file.len;
-        break;
-    case LIST:
-        len += res->list.count * NAME_MAX;
-        break;
-    case MKDIR:
-        break;
+// LENGTH OF A V2 RESPONSE FRAME'S CONTENTS
+usize response_body_len(struct response const *res) {
+    usize len = res->tagged ? varint_len(res->id) : 0;
+    if (res->type == GET) {
+        len += varint_len(res->get.file.len) + optionals_len((u64 const[]){ res->get.codec, res->get.checksum }, 2);
+    } else if (res->type == GET_RANGE) {
+        len += varint_len(res->get.file.len) + varint_len(res->get.part_len);
+    } else if (res->type == LIST) {
+        len += varint_len(res->list.count) + varint_len(res->list.flags) + varint_len(res->list.cursor);
+        for (usize i = 0; i < res->list.count; ++i) {
+            struct list_entry const *e = &res->list.entries[i];
+            len += string_len(e->name_len);
+            if (res->list.flags & LIST_METADATA) {
+                len += 1 + varint_len(e->size) + varint_len(e->mtime);
+            }
+        }
+    } else if (res->type == GET_MULTI) {
+        len += varint_len(res->get_multi.count) + optionals_len((u64 const[]){ res->get_multi.accept, res->get_multi.flags }, 2);
+    } else if (res->type == STAT) {
+        len += varint_len(res->stat.count) + res->stat.count;
+        for (usize i = 0; i < res->stat.count; ++i) {
+            struct part_stat const *st = &res->stat.parts[i];
+            if (st->status == SUCCESS) {
+                len += varint_len(st->size) + varint_len(st->plain_len) + varint_len(st->mtime) + 1 + varint_len(st->checksum);
+            }
+        }
     }
-
     return len;
 }
 
-int invalid_identity(struct users const *users, char const *username, char const *password) {
-    for (usize i = 0; i < users->len; ++i) {
-        if (strings_equal(username, users->username[i]) && strings_equal(password, users->password[i])) {
-            return 0;
+// LENGTH OF THE RESPONSE HEADER, OR OF THE WHOLE FRAME IN V2, NOT COUNTING
+// A GET'S BODY OR A GET_MULTI'S PARTS
+usize response_header_len(struct response const *res) {
+    if (res->version == WIRE_V1) {
+        usize len = sizeof(struct response_header);
+        if (res->type == LIST) {
+            len += res->list.count * NAME_MAX;
         }
+        return len;
     }
-    return 1;
+    usize body_len = response_body_len(res);
+    return 3 + varint_len(body_len) + body_len;
 }
 
-int handle_put(char const *dir, char const *path, byte const *file, usize filelen, struct response *res) {
-    // must not be prepended with root slash
-    if (path[0] == '/') {
-        path = path + 1;
+usize responselen(struct response const *res) {
+    usize len = response_header_len(res);
+    if (has_get_body(res->type)) {
+        len += res->get.file.len;
     }
+    return len;
+}
 
-    char *fullpath = join_paths(dir, path);
+// PATHS ARRIVE ABSOLUTE OR RELATIVE TO THE USER'S DIRECTORY, AND ARE ALWAYS
+// OPENED RELATIVE TO ITS FD
+char const *relative_path(char const *path) {
+    path += strspn(path, "/");
+    return path[0] != '\0' ? path : ".";
+}
 
-    TRACE("writing file %s", fullpath);
-    int err = write_file(fullpath, file, filelen);
-    if (err != 0) {
+// PUT AND GET ONLY OPEN THE PART FILE AND ATTACH IT TO THE RESPONSE: THE
+// EVENT LOOP MOVES THE BODY ITSELF, SO NO FILE IS EVER BUFFERED WHOLE. AN
+// ENCODED BODY IS STORED AS IT ARRIVES, WITH ITS CODEC AND CHECKSUM RECORDED
+// ON THE FILE. THE SERVER NEVER READS THE BODY, SO IT NEVER CHECKS IT EITHER:
+// THE CLIENT THAT GETS THE PART DOES.
+//
+// A PUT GOES TO AN ANONYMOUS FILE IN THE PART'S DIRECTORY, WHICH ONLY
+// REPLACES THE PART ONCE THE WHOLE BODY HAS BEEN WRITTEN (SEE commit_put).
+// AN UPLOAD CUT SHORT JUST CLOSES IT, LEAVING ANY COPY ALREADY THERE ALONE.
+int open_put(int dir, u64 store_codecs, struct request const *req, struct response *res) {
+    char const *path = relative_path(req->put.path);
+    if (req->put.codec > CODEC_MAX
+        || (req->put.codec != CODEC_NONE && !(store_codecs & CODEC_BIT(req->put.codec))))
+    {
+        res->status = UNSUPPORTED_CODEC;
+        return 0;
+    }
+
+    char *parent = strdup(path);
+    char *slash = strrchr(parent, '/');
+    if (slash) {
+        *slash = '\0';
+    }
+    TRACE("opening file %s for writing", path);
+    int fd = openat(dir, slash ? parent : ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+    free(parent);
+    if (fd == -1) {
+        TRACE("error opening file %s for writing: %s", path, system_error());
         res->status = INVALID_PATH;
+    } else if (store_codec(fd, req->put.codec, req->put.plain_len) != 0) {
+        TRACE("unable to record codec of %s: %s", path, system_error());
+        close(fd);
+        res->status = UNSUPPORTED_CODEC;
     } else {
+        if (store_checksum(fd, req->put.checksum) != 0) {
+            TRACE("unable to record checksum of %s: %s", path, system_error());
+        }
         res->status = SUCCESS;
+        res->fd = fd;
     }
-
-    free(fullpath);
     return 0;
 }
 
-int handle_get(char const *dir, char const *path, struct response *res) {
-    if (path[0] == '/') {
-        path = path + 1;
-    }
-    char *fullpath = join_paths(dir, path);
+// LINKS THE FILE open_put WROTE A PUT'S BODY INTO IN PLACE OF THE PART, ONCE
+// THE BODY IS COMPLETE. IT GETS A TEMPORARY NAME FIRST, WHICH IS THEN RENAMED
+// OVER THE PART, SO READERS SEE EITHER THE OLD PART OR THE NEW ONE WHOLE. THE
+// TEMPORARY NAME HAS THE FILE'S FD IN IT, SO TWO PUTS OF ONE PART AT ONCE
+// NEVER SHARE IT.
+int commit_put(int dir, struct request const *req, struct response *res) {
+    char const *path = relative_path(req->put.path);
+    char fd_path[32];
+    sprintf(fd_path, "/proc/self/fd/%d", res->fd);
+    char *tmp_path = malloc(strlen(path) + 32);
+    sprintf(tmp_path, "%s.%d.put", path, res->fd);
 
-    TRACE("getting file %s", fullpath);
-    int err = read_file(fullpath, &res->get.file.buf, &res->get.file.len);
+    int err = -1;
+    // ONE LEFT BY A SERVER THAT DIED BETWEEN THE TWO STEPS
+    unlinkat(dir, tmp_path, 0);
+    if (linkat(AT_FDCWD, fd_path, dir, tmp_path, AT_SYMLINK_FOLLOW) != 0) {
+        TRACE("unable to link file %s: %s", tmp_path, system_error());
+    } else if (renameat(dir, tmp_path, dir, path) != 0) {
+        TRACE("unable to replace file %s: %s", path, system_error());
+        unlinkat(dir, tmp_path, 0);
+    } else {
+        err = 0;
+    }
     if (err != 0) {
+        res->status = INVALID_PATH;
+    }
+    free(tmp_path);
+    return err;
+}
+
+// REPLACES AN ENCODED PART FILE WITH AN ANONYMOUS TEMPORARY FILE HOLDING
+// THE PLAIN BYTES [offset, offset + length) OF IT, SO THEY CAN BE SENT LIKE
+// ANY OTHER RANGE. ONLY THE CHUNKS COVERING THEM ARE DECODED. SETS
+// *plain_len TO THE LENGTH OF THE WHOLE PART DECODED.
+int decode_range(int dir, int fd, u64 offset, u64 length, u64 *plain_len) {
+    int plain = openat(dir, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (plain == -1) {
+        TRACE("unable to make temporary file: %s", system_error());
+    } else if (decompress_range(fd, offset, length, plain, plain_len) < 0) {
+        close(plain);
+        plain = -1;
+    }
+    close(fd);
+    return plain;
+}
+
+// OPENS length BYTES OF A PART FILE FROM offset, CLAMPED TO THE END OF THE
+// FILE. RANGES UP TO GET_INLINE_MAX ARE READ INTO THE RESPONSE WITH pread,
+// LONGER ONES KEEP THE FILE OPEN FOR THE EVENT LOOP TO SEND FROM offset. AN
+// ENCODED PART IS SENT AS STORED IF accept HAS ITS CODEC, AND OTHERWISE JUST
+// THE RANGE IS DECODED FIRST.
+int open_range(int dir, char const *path, u64 offset, u64 length, u64 accept, struct response *res) {
+    path = relative_path(path);
+
+    TRACE("opening file %s for reading", path);
+    struct stat st = {0};
+    int fd = openat(dir, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) {
+            close(fd);
+        }
         res->status = FILE_NOT_FOUND;
-    } else {
-        res->status = SUCCESS;
+        return 0;
+    }
+    res->get.codec = stored_codec(fd, NULL);
+    if (res->get.flags & GET_CHECKSUMS) {
+        res->get.checksum = stored_checksum(fd);
+    }
+    res->status = SUCCESS;
+    res->get.part_len = st.st_size;
+    if (res->get.codec != CODEC_NONE && !(accept & CODEC_BIT(res->get.codec))) {
+        res->get.codec = CODEC_NONE;
+        fd = decode_range(dir, fd, offset, length, &res->get.part_len);
+        if (fd == -1 || fstat(fd, &st) != 0) {
+            if (fd != -1) {
+                close(fd);
+            }
+            res->status = INVALID_PATH;
+            return 0;
+        }
+        // THE TEMPORARY FILE HOLDS JUST THE RANGE
+        offset = 0;
+    }
+
+    u64 size = st.st_size;
+    if (offset > size) {
+        offset = size;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+    res->get.offset = offset;
+    if (length > GET_INLINE_MAX) {
+        res->fd = fd;
+        res->get.file.len = length;
+        return 0;
     }
 
-    free(fullpath);
+    res->get.file.buf = malloc(length > 0 ? length : 1);
+    usize len = 0;
+    while (len < length) {
+        isize n = pread(fd, &res->get.file.buf[len], length - len, offset + len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    res->get.file.len = len;
+    close(fd);
     return 0;
 }
 
-int handle_list(char const *rootdir, char const *path, struct response *res) {
-    if (path[0] == '/') {
-        path = path + 1;
+int open_get(int dir, char const *path, u64 accept, u64 flags, struct response *res) {
+    res->get.accept = accept;
+    res->get.flags = flags;
+    return open_range(dir, path, 0, (u64)-1, accept, res);
+}
+
+char const *entry_name(struct response const *res, usize i) {
+    return &res->list.names[res->list.entries[i].name];
+}
+
+// APPENDS AN ENTRY NAMED name, GROWING THE ENTRY ARRAY AND NAME BUFFER BY
+// DOUBLING. RETURNS NULL IF MEMORY RUNS OUT.
+struct list_entry *add_list_entry(struct response *res, usize *entries_cap, usize *names_cap, char const *name) {
+    usize name_len = strlen(name);
+    if (res->list.count == *entries_cap) {
+        usize cap = *entries_cap ? *entries_cap * 2 : 64;
+        struct list_entry *entries = realloc(res->list.entries, cap * sizeof(struct list_entry));
+        if (!entries) {
+            return NULL;
+        }
+        res->list.entries = entries;
+        *entries_cap = cap;
+    }
+    if (res->list.names_len + name_len + 1 > *names_cap) {
+        usize cap = *names_cap ? *names_cap : 1024;
+        while (res->list.names_len + name_len + 1 > cap) {
+            cap *= 2;
+        }
+        char *names = realloc(res->list.names, cap);
+        if (!names) {
+            return NULL;
+        }
+        res->list.names = names;
+        *names_cap = cap;
     }
-    char *fullpath = join_paths(rootdir, path);
 
-    TRACE("opening directory %s for listing", fullpath);
-    DIR *dir = opendir(fullpath);
+    struct list_entry *e = &res->list.entries[res->list.count];
+    memset(e, 0, sizeof(struct list_entry));
+    e->name = res->list.names_len;
+    e->name_len = name_len;
+    memcpy(&res->list.names[res->list.names_len], name, name_len + 1);
+    res->list.names_len += name_len + 1;
+    res->list.count += 1;
+    return e;
+}
+
+byte entry_kind(mode_t mode) {
+    if (S_ISREG(mode)) {
+        return ENTRY_FILE;
+    }
+    if (S_ISDIR(mode)) {
+        return ENTRY_DIR;
+    }
+    return ENTRY_OTHER;
+}
+
+// LISTS ONE PAGE OF THE DIRECTORY INTO PACKED ENTRIES, STARTING AT THE
+// REQUEST'S cursor. CURSORS ARE telldir POSITIONS: LINUX DIRECTORY OFFSETS
+// ARE COOKIES THAT STAY VALID ACROSS opendir CALLS, SO EACH PAGE ONLY READS
+// ITS OWN ENTRIES, AND ENTRIES ADDED OR REMOVED BETWEEN PAGES DON'T SHIFT THE
+// ONES AROUND THEM. A limit OF 0 (V1) LISTS EVERYTHING. WITH LIST_METADATA,
+// EACH ENTRY ALSO GETS ITS KIND, SIZE AND MTIME FROM AN fstatat RELATIVE TO
+// THE OPEN DIRECTORY, SO NO PATHS ARE BUILT OR RESOLVED PER ENTRY.
+int handle_list(int userdir, struct request const *req, struct response *res) {
+    char const *path = relative_path(req->list.path);
+
+    TRACE("opening directory %s for listing", path);
+    int fd = openat(userdir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd != -1 ? fdopendir(fd) : NULL;
     if (!dir) {
         if (errno == ENOTDIR) {
             res->status = NOT_DIRECTORY;
         } else if (errno == ENOENT) {
             res->status = FILE_NOT_FOUND;
         } else {
-            panic("unexpected opendir error");
+            // ENAMETOOLONG, ELOOP, EACCES AND THE LIKE ARE THE CLIENT'S DOING,
+            // SO THEY FAIL THIS REQUEST ALONE
+            TRACE("error opening directory %s: %s", path, system_error());
+            res->status = INVALID_PATH;
+        }
+        if (fd != -1) {
+            close(fd);
         }
         return 0;
     }
+    if (req->list.cursor) {
+        seekdir(dir, req->list.cursor);
+    }
 
     res->status = SUCCESS;
-    res->list.filenames = NULL;
-    res->list.count = 0;
-    for (struct dirent *de = readdir(dir);
-         de != NULL;
-         de = readdir(dir))
-    {
+    res->list.flags = req->list.flags & LIST_METADATA;
+    usize entries_cap = 0;
+    usize names_cap = 0;
+    for (;;) {
+        long pos = telldir(dir);
+        struct dirent *de = readdir(dir);
+        if (!de) {
+            break;
+        }
         if (strings_equal(de->d_name, ".") || strings_equal(de->d_name, "..")) {
             continue;
         }
-        TRACE("adding directory entry %s to list", de->d_name);
-        res->list.count += 1;
-        res->list.filenames = realloc(res->list.filenames, sizeof(char *) * res->list.count);
-        res->list.filenames[res->list.count - 1] = malloc(NAME_MAX);
-        usize d_name_len = strlen(de->d_name);
-        memcpy(res->list.filenames[res->list.count - 1], de->d_name, d_name_len);
-        if (d_name_len < NAME_MAX) {
-            (res->list.filenames[res->list.count - 1])[d_name_len] = '\0';
+        if (req->list.limit && res->list.count == req->list.limit) {
+            // THE PAGE IS FULL AND de IS LEFT FOR THE NEXT ONE
+            res->list.flags |= LIST_MORE;
+            res->list.cursor = pos;
+            break;
+        }
+        struct list_entry *e = add_list_entry(res, &entries_cap, &names_cap, de->d_name);
+        if (!e) {
+            panic("out of memory listing directory");
+        }
+        if (res->list.flags & LIST_METADATA) {
+            struct stat st;
+            if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                e->kind = entry_kind(st.st_mode);
+                e->size = st.st_size;
+                e->mtime = st.st_mtim.tv_sec > 0 ? st.st_mtim.tv_sec : 0;
+            } else {
+                e->kind = ENTRY_OTHER;
+            }
         }
     }
+    TRACE("listed %zu directory entries", res->list.count);
 
     closedir(dir);
-    free(fullpath);
     return 0;
 }
 
-int handle_mkdir(char const *rootdir, char const *path, struct response *res) {
-    if (path[0] == '/') {
-        path = path + 1;
+// OPENS EVERY REQUESTED PART AS ITS OWN GET, SO EACH ONE IS EITHER INLINED
+// OR SENT FROM ITS PART FILE JUST AS A SINGLE GET WOULD BE
+int handle_get_multi(int dir, struct request const *req, struct response *res) {
+    res->status = SUCCESS;
+    res->get_multi.parts = calloc(req->get_multi.count > 0 ? req->get_multi.count : 1, sizeof(struct response));
+    res->get_multi.count = req->get_multi.count;
+    res->get_multi.accept = req->get_multi.accept;
+    res->get_multi.flags = req->get_multi.flags;
+    for (usize i = 0; i < req->get_multi.count; ++i) {
+        struct response *part = &res->get_multi.parts[i];
+        part->type = GET;
+        part->version = res->version;
+        open_get(dir, req->get_multi.paths[i], req->get_multi.accept, req->get_multi.flags, part);
     }
-    char *fullpath = join_paths(rootdir, path);
+    return 0;
+}
 
-    TRACE("making directory %s", fullpath);
-    int err = mkdir(fullpath, 0777);
+// LOOKS UP EVERY REQUESTED PART FILE'S SIZE, MTIME, CODEC AND CHECKSUM FROM
+// ITS INODE AND EXTENDED ATTRIBUTES, WITHOUT READING A BYTE OF IT
+int handle_stat(int dir, struct request const *req, struct response *res) {
+    res->status = SUCCESS;
+    res->stat.parts = calloc(req->stat.count > 0 ? req->stat.count : 1, sizeof(struct part_stat));
+    res->stat.count = req->stat.count;
+    for (usize i = 0; i < req->stat.count; ++i) {
+        struct part_stat *part = &res->stat.parts[i];
+        struct stat st;
+        int fd = openat(dir, relative_path(req->stat.paths[i]), O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            part->status = FILE_NOT_FOUND;
+        } else {
+            part->status = SUCCESS;
+            part->size = st.st_size;
+            part->mtime = st.st_mtim.tv_sec > 0 ? st.st_mtim.tv_sec : 0;
+            part->codec = stored_codec(fd, &part->plain_len);
+            if (part->codec == CODEC_NONE) {
+                part->plain_len = part->size;
+            }
+            part->checksum = stored_checksum(fd);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+int handle_mkdir(int dir, char const *path, struct response *res) {
+    path = relative_path(path);
+
+    TRACE("making directory %s", path);
+    int err = mkdirat(dir, path, 0777);
     if (err != 0) {
         if (errno == EEXIST) {
             res->status = PATH_ALREADY_EXISTS;
@@ -139,49 +423,61 @@ int handle_mkdir(char const *rootdir, char const *path, struct response *res) {
             res->status = INVALID_PATH;
         }
     }
-
-    free(fullpath);
     return 0;
 }
 
-int make_response(char const *root, struct users const *users, struct request const *req, struct response *res) {
+// ANSWERS req AS user, WHICH THE EVENT LOOP RESOLVED FROM THE REQUEST'S
+// CREDENTIALS OR THE CONNECTION'S SESSION WHEN IT WAS DISPATCHED, AND WHICH
+// IS NULL IF THEY DIDN'T CHECK OUT
+int make_response(struct users const *users, struct user *user, struct request const *req, struct response *res) {
     memset(res, 0, sizeof(struct response));
     res->type = req->type;
+    res->version = req->version;
+    res->tagged = req->tagged;
+    res->id = req->id;
 
-    if (invalid_identity(users, req->username, req->password)) {
-        TRACE("invalid identity %s:%s", req->username, req->password);
+    if (!user) {
         res->status = INVALID_IDENTITY;
         return 0;
     }
+    if (req->type == LOGIN) {
+        res->status = SUCCESS;
+        return 0;
+    }
 
-    char *dir = join_paths(root, req->username);
-    struct stat st = {0};
-    int err = stat(dir, &st);
-    if (err != 0) {
-        TRACE("user %s dir does not exist, creating at %s...", req->username, dir);
-        mkdir(dir, 0700);
+    int dir = user_dir(users, user);
+    if (dir == -1) {
+        res->status = INVALID_PATH;
+        return 0;
     }
 
     switch (req->type) {
     case PUT:
-        handle_put(dir, req->put.path, req->put.file.buf, req->put.file.len, res);
+        open_put(dir, users->store_codecs, req, res);
+        break;
+    case GET_MULTI:
+        handle_get_multi(dir, req, res);
+        break;
+    case GET_RANGE:
+        open_range(dir, req->get_range.path, req->get_range.offset, req->get_range.length, 0, res);
         break;
     case GET:
-        handle_get(dir, req->get.path, res);
+        open_get(dir, req->get.path, req->get.accept, req->get.flags, res);
         break;
     case LIST:
-        handle_list(dir, req->list.path, res);
+        handle_list(dir, req, res);
         break;
     case MKDIR:
         handle_mkdir(dir, req->mkdir.path, res);
         break;
+    case STAT:
+        handle_stat(dir, req, res);
+        break;
     }
-
-    free(dir);
-    return -1;
+    return 0;
 }
 
-int serialize_response(struct response const *res, byte *buf) {
+usize serialize_response_header_v1(struct response const *res, byte *buf) {
     struct response_header header = {0};
     header.start = RESPONSE_START;
     header.type = res->type;
@@ -199,15 +495,103 @@ int serialize_response(struct response const *res, byte *buf) {
     }
 
     memcpy(buf, &header, sizeof(struct response_header));
+    usize len = sizeof(struct response_header);
+    if (res->type == LIST) {
+        for (usize i = 0; i < res->list.count; ++i) {
+            usize name_len = res->list.entries[i].name_len;
+            memcpy(&buf[len], entry_name(res, i), name_len);
+            memset(&buf[len + name_len], 0, NAME_MAX - name_len);
+            len += NAME_MAX;
+        }
+    }
+    return len;
+}
 
+usize serialize_response_header_v2(struct response const *res, byte *buf) {
+    struct wire_writer w = { buf };
+    put_byte(&w, WIRE_START_V2);
+    put_byte(&w, res->tagged ? res->type | REQUEST_TAGGED : res->type);
+    put_byte(&w, res->status);
+    put_varint(&w, response_body_len(res));
+    if (res->tagged) {
+        put_varint(&w, res->id);
+    }
     if (res->type == GET) {
-        memcpy(&buf[sizeof(struct response_header)], res->get.file.buf, res->get.file.len);
+        put_varint(&w, res->get.file.len);
+        put_optionals(&w, (u64 const[]){ res->get.codec, res->get.checksum }, 2);
+    } else if (res->type == GET_RANGE) {
+        put_varint(&w, res->get.file.len);
+        put_varint(&w, res->get.part_len);
+    } else if (res->type == GET_MULTI) {
+        put_varint(&w, res->get_multi.count);
+        put_optionals(&w, (u64 const[]){ res->get_multi.accept, res->get_multi.flags }, 2);
+    } else if (res->type == STAT) {
+        put_varint(&w, res->stat.count);
+        for (usize i = 0; i < res->stat.count; ++i) {
+            struct part_stat const *st = &res->stat.parts[i];
+            put_byte(&w, st->status);
+            if (st->status == SUCCESS) {
+                put_varint(&w, st->size);
+                put_varint(&w, st->plain_len);
+                put_varint(&w, st->mtime);
+                put_byte(&w, st->codec);
+                put_varint(&w, st->checksum);
+            }
+        }
     } else if (res->type == LIST) {
+        put_varint(&w, res->list.count);
+        put_varint(&w, res->list.flags);
+        put_varint(&w, res->list.cursor);
         for (usize i = 0; i < res->list.count; ++i) {
-            memcpy(&buf[sizeof(struct response_header) + NAME_MAX * i], res->list.filenames[i], NAME_MAX);
+            struct list_entry const *e = &res->list.entries[i];
+            put_string(&w, entry_name(res, i), e->name_len);
+            if (res->list.flags & LIST_METADATA) {
+                put_byte(&w, e->kind);
+                put_varint(&w, e->size);
+                put_varint(&w, e->mtime);
+            }
         }
     }
+    return w.p - buf;
+}
+
+usize multi_part_header_len(struct response const *part) {
+    usize len = 1 + (part->get.accept ? 1 : 0) + varint_len(part->status == SUCCESS ? part->get.file.len : 0);
+    if (part->get.flags & GET_CHECKSUMS) {
+        len += varint_len(part->status == SUCCESS ? part->get.checksum : 0);
+    }
+    return len;
+}
+
+// WRITES THE status, codec, file_len AND checksum THAT GO IN FRONT OF A
+// GET_MULTI PART'S BODY
+usize serialize_multi_part_header(struct response const *part, byte *buf) {
+    struct wire_writer w = { buf };
+    put_byte(&w, part->status);
+    if (part->get.accept) {
+        put_byte(&w, part->get.codec);
+    }
+    put_varint(&w, part->status == SUCCESS ? part->get.file.len : 0);
+    if (part->get.flags & GET_CHECKSUMS) {
+        put_varint(&w, part->status == SUCCESS ? part->get.checksum : 0);
+    }
+    return w.p - buf;
+}
+
+// WRITES EVERYTHING BUT A GET'S BODY OR A GET_MULTI'S PARTS IN THE REQUEST'S
+// WIRE VERSION, AND RETURNS ITS LENGTH
+usize serialize_response_header(struct response const *res, byte *buf) {
+    if (res->version == WIRE_V1) {
+        return serialize_response_header_v1(res, buf);
+    }
+    return serialize_response_header_v2(res, buf);
+}
 
+int serialize_response(struct response const *res, byte *buf) {
+    usize len = serialize_response_header(res, buf);
+    if (has_get_body(res->type)) {
+        memcpy(&buf[len], res->get.file.buf, res->get.file.len);
+    }
     return 0;
 }
 
@@ -225,134 +609,483 @@ char const *status_to_string(byte status) {
         return "path already exists";
     case INVALID_PATH:
         return "path is invalid";
+    case UNSUPPORTED_CODEC:
+        return "codec not supported";
+    case CORRUPT_PART:
+        return "part is corrupt";
     }
+    return "unknown status";
 }
 
 void print_response(struct response const *res) {
     println("type %c", res->type);
+    if (res->tagged) {
+        println("id %llu", (unsigned long long)res->id);
+    }
     println("status %s", status_to_string(res->status));
-    if (res->type == GET) {
-        print("file \"");
-        print_escaped(res->get.file.buf, res->get.file.len);
-        println("\"");
+    if (has_get_body(res->type)) {
+        println("file %zu bytes", res->get.file.len);
+        if (res->get.checksum) {
+            println("crc32c %08x", (u32)res->get.checksum);
+        }
     } else if (res->type == LIST) {
-        println("list entries");
-        for (usize i = 0 ; i < res->list.count; ++i) {
-            print("%s ", res->list.filenames[i]);
+        println("list %zu entries", res->list.count);
+    } else if (res->type == GET_MULTI) {
+        println("%zu parts", res->get_multi.count);
+    } else if (res->type == STAT) {
+        for (usize i = 0; i < res->stat.count; ++i) {
+            struct part_stat const *st = &res->stat.parts[i];
+            println("part %zu %s %llu bytes (%llu plain) crc32c %08x", i, status_to_string(st->status),
+                    (unsigned long long)st->size, (unsigned long long)st->plain_len, (u32)st->checksum);
         }
-        println("");
     }
 }
 
-int recv_put_response(int fd, struct response *res) {
-    byte buf[sizeof(struct response_header)];
-    usize recvd = 0;
-    while (recvd < sizeof(buf)) {
-        usize n = read(fd, &buf[recvd], sizeof(buf) - recvd);
-        if (n == -1) {
-            TRACE("error reading: %s", system_error());
-            continue;
+void drop_response(struct response *res) {
+    if (res) {
+        if (res->fd > 0) {
+            close(res->fd);
         }
-        recvd += n;
+        switch (res->type) {
+        case GET:
+        case GET_RANGE:
+            free(res->get.file.buf);
+            break;
+        case LIST:
+            free(res->list.entries);
+            free(res->list.names);
+            break;
+        case GET_MULTI:
+            for (usize i = 0; i < res->get_multi.count; ++i) {
+                drop_response(&res->get_multi.parts[i]);
+            }
+            free(res->get_multi.parts);
+            break;
+        case STAT:
+            free(res->stat.parts);
+            break;
+        }
+        memset(res, 0, sizeof(struct response));
     }
-    struct response_header *header = (struct response_header *)(buf);
-    assert(header->start == RESPONSE_START);
-    assert(header->type == PUT);
-    res->type = PUT;
-    res->status = header->status;
-    return 0;
 }
 
-int recv_get_response(int fd, struct response *res) {
-    byte buf[sizeof(struct response_header)];
-    usize recvd = 0;
-    while (recvd < sizeof(buf)) {
-        usize n = read(fd, &buf[recvd], sizeof(buf) - recvd);
-        if (n == -1) {
-            TRACE("error reading: %s", system_error());
-            continue;
+// RECEIVES fixed_len BYTES INTO fixed AND THE VARINT THAT FOLLOWS THEM. THE
+// FIRST READ TAKES THE VARINT'S FIRST BYTE TOO, SO A SHORT VARINT COSTS NO
+// EXTRA READ.
+int recv_head(int fd, byte *fixed, usize fixed_len, u64 *v) {
+    byte head[4 + VARINT_MAX];
+    usize head_len = fixed_len + 1;
+    if (fixed_len > 4 || recv_all(fd, head, head_len) != 0) {
+        return -1;
+    }
+    while (head[head_len - 1] >= 0x80 && head_len < fixed_len + VARINT_MAX) {
+        if (recv_all(fd, &head[head_len], 1) != 0) {
+            return -1;
         }
-        recvd += n;
+        head_len += 1;
+    }
+    usize varint_bytes;
+    if (peek_varint(&head[fixed_len], head_len - fixed_len, v, &varint_bytes) != 1) {
+        return -1;
     }
-    struct response_header *header = (struct response_header *)(buf);
-    assert(header->start == RESPONSE_START);
-    assert(header->type == GET);
-    res->type = GET;
-    res->status = header->status;
+    memcpy(fixed, head, fixed_len);
+    return 0;
+}
 
-    if (res->status != SUCCESS) {
+// RECEIVES A V2 RESPONSE FRAME, STORING ITS TYPE, STATUS AND ANY id IN res
+// AND RETURNING A READER OVER THE REST OF ITS CONTENTS, WHOSE BUFFER THE
+// CALLER FREES. A FRAME WITH A SHORT BODY ARRIVES IN TWO READS.
+int recv_response_frame(int fd, struct response *res, struct wire_reader *rd, byte **frame) {
+    byte head[3];
+    u64 body_len;
+    if (recv_head(fd, head, sizeof(head), &body_len) != 0 || head[0] != WIRE_START_V2
+        || !known_request_type(head[1] & ~REQUEST_TAGGED)) {
+        TRACE("malformed response frame");
+        return -1;
+    }
+
+    *frame = malloc(body_len > 0 ? body_len : 1);
+    if (!*frame || recv_all(fd, *frame, body_len) != 0) {
+        free(*frame);
+        *frame = NULL;
+        return -1;
+    }
+    rd->p = *frame;
+    rd->end = *frame + body_len;
+    rd->error = 0;
+
+    res->type = head[1] & ~REQUEST_TAGGED;
+    res->version = WIRE_V2;
+    res->status = head[2];
+    if (head[1] & REQUEST_TAGGED) {
+        res->tagged = 1;
+        res->id = get_varint(rd);
+    }
+    return rd->error ? -1 : 0;
+}
+
+// MARKS A BODY WHOSE PLAIN BYTES CAME TO crc AS CORRUPT IF THAT ISN'T ITS
+// CHECKSUM. THE BODY WAS RECEIVED WHOLE, SO THE CONNECTION CAN STILL BE USED.
+void check_body(struct response *res, u32 crc) {
+    if (res->get.checksum && (u32)res->get.checksum != crc) {
+        TRACE("part checksum %08x, expected %08x", crc, (u32)res->get.checksum);
+        res->status = CORRUPT_PART;
+    }
+}
+
+// RECEIVES len BODY BYTES ENCODED WITH codec INTO res->get.file, DECODING
+// EACH CHUNK AS SOON AS IT HAS ARRIVED, SO DECODING OVERLAPS THE TRANSFER
+// AND ONLY ONE ENCODED CHUNK IS EVER HELD. A BODY WITH A checksum IS CHECKED
+// THE SAME WAY, ONE CHUNK OF PLAIN BYTES AT A TIME WHILE IT IS STILL IN
+// CACHE, RATHER THAN IN A SECOND PASS OVER THE WHOLE PART.
+int recv_body(int fd, u64 len, u64 codec, u64 checksum, struct response *res) {
+    res->get.codec = codec;
+    res->get.checksum = checksum;
+    u32 crc = 0;
+    if (codec == CODEC_NONE) {
+        res->get.file.len = len;
+        res->get.file.buf = malloc(len > 0 ? len : 1);
+        if (!checksum) {
+            return recv_all(fd, res->get.file.buf, len);
+        }
+        for (usize done = 0; done < len; ) {
+            usize n = len - done < CODEC_CHUNK ? len - done : CODEC_CHUNK;
+            if (recv_all(fd, &res->get.file.buf[done], n) != 0) {
+                return -1;
+            }
+            crc = crc32c(crc, &res->get.file.buf[done], n);
+            done += n;
+        }
+        check_body(res, crc);
         return 0;
     }
+    if (codec != CODEC_ZLIB) {
+        return -1;
+    }
 
-    res->get.file.len = header->get.file_len;
-    res->get.file.buf = malloc(res->get.file.len);
-    recvd = 0;
-    while (recvd < res->get.file.len) {
-        usize n = read(fd, &res->get.file.buf[recvd], res->get.file.len - recvd);
-        if (n == -1) {
-            TRACE("error reading: %s", system_error());
+    usize capacity = len > 0 ? len : 1;
+    res->get.file.buf = malloc(capacity);
+    res->get.file.len = 0;
+    byte *chunk = malloc(CODEC_CHUNK);
+    int err = -1;
+    while (len > 0) {
+        byte none;
+        u64 raw_len, stored_len;
+        if (recv_head(fd, &none, 0, &raw_len) != 0 || recv_head(fd, &none, 0, &stored_len) != 0) {
+            goto cleanup;
+        }
+        usize header_len = varint_len(raw_len) + varint_len(stored_len);
+        if (raw_len > CODEC_CHUNK || stored_len > raw_len || header_len + stored_len > len) {
+            TRACE("malformed compressed chunk");
+            goto cleanup;
+        }
+        while (res->get.file.len + raw_len > capacity) {
+            capacity *= 2;
+        }
+        res->get.file.buf = realloc(res->get.file.buf, capacity);
+        if (recv_all(fd, chunk, stored_len) != 0) {
+            goto cleanup;
+        }
+        if (decompress_chunk(chunk, stored_len, &res->get.file.buf[res->get.file.len], raw_len) != 0) {
+            // THE CHUNK'S LENGTHS HELD, SO THE NEXT ONE CAN STILL BE FOUND
+            // AND ONLY THIS PART IS LOST
+            res->status = CORRUPT_PART;
+        } else if (checksum) {
+            crc = crc32c(crc, &res->get.file.buf[res->get.file.len], raw_len);
         }
-        recvd += n;
+        res->get.file.len += raw_len;
+        len -= header_len + stored_len;
     }
+    check_body(res, crc);
+    err = 0;
 
-    return 0;
+cleanup:
+    free(chunk);
+    return err;
 }
 
-int recv_list_response(int fd, struct response *res) {
-    set_nonblocking(fd, 0);
-    byte buf[sizeof(struct response_header)];
-    usize recvd = 0;
-    while (recvd < sizeof(buf)) {
-        usize n = read(fd, &buf[recvd], sizeof(buf) - recvd);
-        if (n == -1) {
-            TRACE("error reading: %s", system_error());
-            continue;
+// RECEIVES A BODY LIKE recv_body, BUT WRITES EACH CHUNK OF PLAIN BYTES TO
+// sink AS SOON AS IT IS DECODED AND CHECKED, SO A PART OF ANY SIZE NEEDS TWO
+// CHUNKS OF MEMORY. file.len COUNTS THE BYTES WRITTEN AND file.buf STAYS
+// NULL. A CHUNK THAT WON'T DECODE IS SKIPPED, LEAVING THE PART CORRUPT.
+int recv_body_to(int fd, u64 len, u64 codec, u64 checksum, struct body_sink const *sink, struct response *res) {
+    res->get.codec = codec;
+    res->get.checksum = checksum;
+    res->get.file.len = 0;
+    if (codec != CODEC_NONE && codec != CODEC_ZLIB) {
+        return -1;
+    }
+
+    byte *chunk = malloc(CODEC_CHUNK);
+    byte *plain = codec == CODEC_NONE ? chunk : malloc(CODEC_CHUNK);
+    u32 crc = 0;
+    int err = -1;
+    while (len > 0) {
+        u64 raw_len, stored_len;
+        usize header_len = 0;
+        if (codec == CODEC_NONE) {
+            raw_len = len < CODEC_CHUNK ? len : CODEC_CHUNK;
+            stored_len = raw_len;
+        } else {
+            byte none;
+            if (recv_head(fd, &none, 0, &raw_len) != 0 || recv_head(fd, &none, 0, &stored_len) != 0) {
+                goto cleanup;
+            }
+            header_len = varint_len(raw_len) + varint_len(stored_len);
+            if (raw_len > CODEC_CHUNK || stored_len > raw_len || header_len + stored_len > len) {
+                TRACE("malformed compressed chunk");
+                goto cleanup;
+            }
+        }
+        if (res->get.file.len + raw_len > sink->len) {
+            TRACE("body runs past the %llu bytes expected", (unsigned long long)sink->len);
+            goto cleanup;
+        }
+        if (recv_all(fd, chunk, stored_len) != 0) {
+            goto cleanup;
         }
-        recvd += n;
+        if (codec != CODEC_NONE && decompress_chunk(chunk, stored_len, plain, raw_len) != 0) {
+            res->status = CORRUPT_PART;
+        } else {
+            if (checksum) {
+                crc = crc32c(crc, plain, raw_len);
+            }
+            xor_file(plain, raw_len, sink->mask);
+            if (pwrite_all(sink->fd, plain, raw_len, sink->offset + res->get.file.len) != 0) {
+                goto cleanup;
+            }
+        }
+        res->get.file.len += raw_len;
+        len -= header_len + stored_len;
+    }
+    check_body(res, crc);
+    err = 0;
+
+cleanup:
+    if (plain != chunk) {
+        free(plain);
+    }
+    free(chunk);
+    return err;
+}
+
+// RECEIVES THE BODY THAT FOLLOWS A GET OR GET_RANGE FRAME, INTO sink IF
+// THERE IS ONE
+int recv_get_body(int fd, struct wire_reader *rd, struct body_sink const *sink, struct response *res) {
+    usize file_len = get_varint(rd);
+    u64 codec = CODEC_NONE;
+    u64 checksum = 0;
+    if (res->type == GET_RANGE) {
+        res->get.part_len = get_varint(rd);
+    } else {
+        codec = get_optional(rd);
+        checksum = get_optional(rd);
     }
-    struct response_header *header = (struct response_header *)(buf);
-    assert(header->start == RESPONSE_START);
-    assert(header->type == LIST);
-    res->type = LIST;
-    res->status = header->status;
+    if (rd->error) {
+        return -1;
+    }
+    if (res->status != SUCCESS) {
+        return 0;
+    }
+    if (sink) {
+        return recv_body_to(fd, file_len, codec, checksum, sink, res);
+    }
+    return recv_body(fd, file_len, codec, checksum, res);
+}
 
+// PARSES A LIST RESPONSE OUT OF ITS FRAME, WHICH recv_response_frame READ
+// WHOLE. NAMES ARE COPIED INTO ONE BUFFER, WHICH NEVER NEEDS MORE BYTES THAN
+// THE FRAME ITSELF.
+int parse_list_frame(struct wire_reader *rd, struct response *res) {
     if (res->status != SUCCESS) {
         return 0;
     }
 
-    res->list.count = header->list.count;
-    res->list.filenames = malloc(sizeof(char *) * res->list.count);
-    for (usize i = 0; i < res->list.count; ++i) {
-        byte namebuf[NAME_MAX];
-        memset(namebuf, 0, sizeof(namebuf));
-        usize n = read(fd, namebuf, NAME_MAX);
-        assert(n == NAME_MAX);
-        TRACE("received filename \"%.*s\"", NAME_MAX, namebuf);
-        res->list.filenames[i] = strndup(namebuf, NAME_MAX);
+    usize frame_len = rd->end - rd->p;
+    usize count = get_varint(rd);
+    res->list.flags = get_varint(rd);
+    res->list.cursor = get_varint(rd);
+    // EVERY ENTRY TAKES AT LEAST ITS LENGTH BYTE
+    if (count > (usize)(rd->end - rd->p)) {
+        rd->error = 1;
+        count = 0;
     }
-    set_nonblocking(fd, 1);
-    return 0;
+    res->list.entries = calloc(count > 0 ? count : 1, sizeof(struct list_entry));
+    res->list.names = malloc(frame_len > 0 ? frame_len : 1);
+    res->list.count = 0;
+    res->list.names_len = 0;
+    for (usize i = 0; i < count && !rd->error; ++i) {
+        struct list_entry *e = &res->list.entries[i];
+        usize name_len = get_varint(rd);
+        byte const *name = get_bytes(rd, name_len);
+        if (res->list.flags & LIST_METADATA) {
+            e->kind = get_byte(rd);
+            e->size = get_varint(rd);
+            e->mtime = get_varint(rd);
+        }
+        if (rd->error) {
+            break;
+        }
+        e->name = res->list.names_len;
+        e->name_len = name_len;
+        memcpy(&res->list.names[e->name], name, name_len);
+        res->list.names[e->name + name_len] = '\0';
+        res->list.names_len += name_len + 1;
+        res->list.count += 1;
+    }
+    return rd->error ? -1 : 0;
 }
 
-int recv_mkdir_response(int fd, struct response *res) {
-    set_nonblocking(fd, 0);
-
-    byte buf[sizeof(struct response_header)];
-    usize recvd = 0;
-    while (recvd < sizeof(buf)) {
-        usize n = read(fd, &buf[recvd], sizeof(buf) - recvd);
-        if (n == -1) {
-            TRACE("error reading: %s", system_error());
-            continue;
+// PARSES A STAT RESPONSE OUT OF ITS FRAME, WHICH recv_response_frame READ
+// WHOLE
+int parse_stat_frame(struct wire_reader *rd, struct response *res) {
+    if (res->status != SUCCESS) {
+        return 0;
+    }
+
+    usize count = get_varint(rd);
+    // EVERY ENTRY TAKES AT LEAST ITS STATUS BYTE
+    if (count > (usize)(rd->end - rd->p)) {
+        rd->error = 1;
+        count = 0;
+    }
+    res->stat.parts = calloc(count > 0 ? count : 1, sizeof(struct part_stat));
+    res->stat.count = count;
+    for (usize i = 0; i < count && !rd->error; ++i) {
+        struct part_stat *st = &res->stat.parts[i];
+        st->status = get_byte(rd);
+        if (st->status == SUCCESS) {
+            st->size = get_varint(rd);
+            st->plain_len = get_varint(rd);
+            st->mtime = get_varint(rd);
+            st->codec = get_byte(rd);
+            st->checksum = get_varint(rd);
         }
-        recvd += n;
+    }
+    return rd->error ? -1 : 0;
+}
+
+// RECEIVES EVERY PART THAT FOLLOWS A GET_MULTI FRAME
+int recv_multi_parts(int fd, struct wire_reader *rd, struct response *res) {
+    usize count = get_varint(rd);
+    res->get_multi.accept = get_optional(rd);
+    res->get_multi.flags = get_optional(rd);
+    if (rd->error || count > GET_MULTI_MAX) {
+        return -1;
     }
 
-    struct response_header *header = (struct response_header *)(buf);
-    assert(header->start == RESPONSE_START);
-    assert(header->type == MKDIR);
-    res->type = MKDIR;
-    res->status = header->status;
-    set_nonblocking(fd, 1);
+    res->get_multi.parts = calloc(count > 0 ? count : 1, sizeof(struct response));
+    for (usize i = 0; i < count; ++i) {
+        struct response *part = &res->get_multi.parts[i];
+        res->get_multi.count += 1;
+        part->type = GET;
+        part->version = WIRE_V2;
+
+        // status, AND codec IF THE REQUEST ACCEPTED ANY
+        byte head[2] = {0};
+        u64 file_len;
+        if (recv_head(fd, head, res->get_multi.accept ? 2 : 1, &file_len) != 0) {
+            return -1;
+        }
+        u64 checksum = 0;
+        if ((res->get_multi.flags & GET_CHECKSUMS) && recv_head(fd, head, 0, &checksum) != 0) {
+            return -1;
+        }
+        part->status = head[0];
+        part->get.accept = res->get_multi.accept;
+        part->get.flags = res->get_multi.flags;
+        if (recv_body(fd, file_len, head[1], checksum, part) != 0) {
+            return -1;
+        }
+    }
     return 0;
 }
+
+// RECEIVES THE NEXT V2 RESPONSE, WHATEVER ITS TYPE, WITH EVERYTHING THAT
+// FOLLOWS ITS FRAME. A CLIENT WITH SEVERAL TAGGED REQUESTS IN FLIGHT ON ONE
+// CONNECTION MATCHES THE RESPONSES UP BY id, IN WHATEVER ORDER THEY COME. A
+// GET BODY GOES TO sink IF THERE IS ONE.
+int recv_response_to(int fd, struct body_sink const *sink, struct response *res) {
+    struct wire_reader rd;
+    byte *frame = NULL;
+    memset(res, 0, sizeof(struct response));
+    if (recv_response_frame(fd, res, &rd, &frame) != 0) {
+        free(frame);
+        return -1;
+    }
+
+    int err = 0;
+    switch (res->type) {
+    case GET:
+    case GET_RANGE:
+        err = recv_get_body(fd, &rd, sink, res);
+        break;
+    case LIST:
+        err = parse_list_frame(&rd, res);
+        break;
+    case GET_MULTI:
+        err = recv_multi_parts(fd, &rd, res);
+        break;
+    case STAT:
+        err = parse_stat_frame(&rd, res);
+        break;
+    }
+    free(frame);
+    return err;
+}
+
+int recv_response(int fd, struct response *res) {
+    return recv_response_to(fd, NULL, res);
+}
+
+// RECEIVES THE NEXT RESPONSE, FAILING IF IT ISN'T OF THE GIVEN TYPE
+int recv_typed_response(int fd, byte type, struct body_sink const *sink, struct response *res) {
+    if (recv_response_to(fd, sink, res) != 0) {
+        return -1;
+    }
+    if (res->type != type) {
+        TRACE("expected a response of type %c, got %c", type, res->type);
+        return -1;
+    }
+    return 0;
+}
+
+int recv_put_response(int fd, struct response *res) {
+    return recv_typed_response(fd, PUT, NULL, res);
+}
+
+int recv_get_response(int fd, struct response *res) {
+    return recv_typed_response(fd, GET, NULL, res);
+}
+
+int recv_get_response_to(int fd, struct body_sink const *sink, struct response *res) {
+    return recv_typed_response(fd, GET, sink, res);
+}
+
+int recv_list_response(int fd, struct response *res) {
+    return recv_typed_response(fd, LIST, NULL, res);
+}
+
+int recv_mkdir_response(int fd, struct response *res) {
+    return recv_typed_response(fd, MKDIR, NULL, res);
+}
+
+int recv_get_multi_response(int fd, struct response *res) {
+    return recv_typed_response(fd, GET_MULTI, NULL, res);
+}
+
+int recv_get_range_response(int fd, struct response *res) {
+    return recv_typed_response(fd, GET_RANGE, NULL, res);
+}
+
+int recv_get_range_response_to(int fd, struct body_sink const *sink, struct response *res) {
+    return recv_typed_response(fd, GET_RANGE, sink, res);
+}
+
+int recv_login_response(int fd, struct response *res) {
+    return recv_typed_response(fd, LOGIN, NULL, res);
+}
+
+int recv_stat_response(int fd, struct response *res) {
+    return recv_typed_response(fd, STAT, NULL, res);
+}
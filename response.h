@@ -2,8 +2,12 @@
 #define response_h
 #include "request.h"
 #include "util.h"
+#include "users.h"
 
 #define RESPONSE_START  'T'
+// PARTS UP TO THIS SIZE ARE READ INTO THE RESPONSE INSTEAD OF BEING SENT FROM
+// AN OPEN FD, SO SMALL GET RESPONSES CAN SHARE ONE WRITE
+#define GET_INLINE_MAX  16384
 
 enum {
     SUCCESS,
@@ -12,8 +16,68 @@ enum {
     NOT_DIRECTORY,
     PATH_ALREADY_EXISTS,
     INVALID_PATH,
+    UNSUPPORTED_CODEC,
+    // NEVER SENT: SET BY THE CLIENT ON A PART THAT FAILS ITS CHECKSUM OR
+    // WON'T DECODE
+    CORRUPT_PART,
 };
 
+// V1 RESPONSES START WITH THIS FIXED 16 BYTE HEADER IN HOST BYTE ORDER. A
+// LIST FOLLOWS IT WITH count NAMES PADDED TO NAME_MAX BYTES EACH.
+//
+// V2 RESPONSES ARE A FRAME LAID OUT LIKE A V2 REQUEST (SEE request.h):
+//
+//     WIRE_START_V2 type status frame_len ...
+//
+// THE RESPONSE TO A TAGGED REQUEST SETS REQUEST_TAGGED IN type AND STARTS
+// ITS FRAME WITH THE REQUEST'S id. TAGGED REQUESTS ARE ANSWERED AS SOON AS
+// THEY FINISH, SO THEIR RESPONSES MAY COME BACK IN ANY ORDER; UNTAGGED ONES
+// ARE ANSWERED AFTER EVERYTHING SENT BEFORE THEM.
+//
+// FOLLOWED INSIDE THE FRAME BY file_len [codec [checksum]] FOR GET, WITH THAT
+// MANY BODY BYTES AFTER THE FRAME, ENCODED WITH codec, AND checksum THE ONE
+// STORED WITH THE PART IF IT HAS ONE AND THE REQUEST ASKED (SEE crc32c.h),
+// OR FOR LIST BY count, flags, cursor AND count ENTRIES OF
+//
+//     name [kind size mtime]
+//
+// WHERE kind IS ONE OF THE ENTRY_* BYTES AND size AND mtime (IN SECONDS)
+// ARE VARINTS, ONLY PRESENT WHEN flags HAS LIST_METADATA. WHEN flags HAS
+// LIST_MORE, THE LISTING CONTINUES FROM cursor.
+//
+// A GET_MULTI FRAME HOLDS count, AND THE REQUEST'S accept AND flags IF IT
+// HAD THEM. ONE PART PER REQUESTED PATH FOLLOWS THE FRAME, IN REQUEST ORDER,
+// EACH AS
+//
+//     status [codec] file_len [checksum] body
+//
+// WHERE status IS A BYTE, codec A BYTE THAT IS ONLY PRESENT WHEN THE FRAME
+// HAS accept, file_len A VARINT, 0 FOR A MISSING PART, AND checksum A VARINT
+// THAT IS ONLY PRESENT WHEN flags HAS GET_CHECKSUMS, 0 FOR A PART STORED
+// WITHOUT ONE.
+//
+// A PART IS ONLY SENT ENCODED IF IT WAS STORED THAT WAY AND THE REQUEST
+// ACCEPTS ITS CODEC. OTHERWISE THE SERVER DECODES IT FIRST, AS IT DOES FOR
+// EVERY GET_RANGE.
+//
+// A GET_RANGE FRAME HOLDS file_len AND part_len, THE NUMBER OF BYTES THAT
+// FOLLOW THE FRAME AND THE SIZE OF THE WHOLE PART FILE. file_len IS SHORT OF
+// THE REQUESTED length WHEN THE RANGE RUNS PAST THE END OF THE PART.
+//
+// A STAT FRAME HOLDS count AND ONE ENTRY PER REQUESTED PATH, IN REQUEST
+// ORDER, EACH AS
+//
+//     status [size plain_len mtime codec checksum]
+//
+// WHERE status AND codec ARE BYTES AND THE REST VARINTS, ONLY PRESENT WHEN
+// status IS SUCCESS. size IS WHAT THE PART TAKES ON DISK AND plain_len WHAT
+// IT DECODES TO, WHICH IS 0 IF AN ENCODED PART WAS PUT WITHOUT IT. checksum
+// IS 0 FOR A PART STORED WITHOUT ONE.
+// LIST ENTRY KINDS
+#define ENTRY_FILE      'F'
+#define ENTRY_DIR       'D'
+#define ENTRY_OTHER     'O'
+
 struct response_header {
     byte start;
     byte type;
@@ -29,33 +93,115 @@ struct response_header {
     };
 };
 
+// WHAT STAT FOUND OUT ABOUT ONE PART FILE, WITHOUT READING ANY OF IT
+struct part_stat {
+    byte status;
+    byte codec;
+    u64 size;
+    u64 plain_len;
+    u64 mtime;
+    u64 checksum;
+};
+
+// ONE DIRECTORY ENTRY OF A LIST RESPONSE. NAMES ARE PACKED, NUL-TERMINATED,
+// INTO ONE SHARED BUFFER AND REFERRED TO BY OFFSET, SO A LISTING TAKES TWO
+// ALLOCATIONS HOWEVER MANY ENTRIES IT HAS.
+struct list_entry {
+    usize name;
+    usize name_len;
+    u64 size;
+    u64 mtime;
+    byte kind;
+};
+
+// WHERE A CLIENT HAS A GET BODY WRITTEN INSTEAD OF HELD IN MEMORY: AT MOST
+// len PLAIN BYTES, WRITTEN FROM offset IN fd, EACH XOR'D WITH mask FIRST
+struct body_sink {
+    int fd;
+    u64 offset;
+    u64 len;
+    byte mask;
+};
+
 struct response {
     byte type;
     byte status;
+    // WIRE VERSION OF THE REQUEST BEING ANSWERED
+    byte version;
+    // COPIED FROM THE REQUEST BEING ANSWERED
+    byte tagged;
+    u64 id;
+    // PART FILE OPENED BY make_response FOR THE EVENT LOOP TO MOVE THE BODY
+    // THROUGH, 0 IF NONE (FD 0 IS STDIN, NEVER A PART FILE)
+    int fd;
 
     union {
+        // ALSO USED BY GET_RANGE, WHERE file HOLDS THE REQUESTED BYTES, offset
+        // SAYS WHERE THEY START IN THE PART FILE AND part_len IS ITS SIZE.
+        // codec IS HOW THE BODY IS ENCODED ON THE WIRE AND accept THE CODECS
+        // THE REQUEST ACCEPTED. THE recv_* FUNCTIONS DECODE BODIES AS THEY
+        // ARRIVE, SO ON THE CLIENT file ALWAYS HOLDS PLAIN BYTES, AND CHECK
+        // THEM AGAINST checksum, THE STORED CHECKSUM OF THE WHOLE PART, WHICH
+        // IS ONLY LOOKED UP IF THE REQUEST'S flags ASKED FOR IT.
         struct {
             struct {
                 byte *buf;
                 usize len;
             } file;
+            u64 offset;
+            u64 part_len;
+            u64 codec;
+            u64 accept;
+            u64 checksum;
+            u64 flags;
         } get;
 
         struct {
-            char **filenames;
+            struct list_entry *entries;
             usize count;
+            char *names;
+            usize names_len;
+            u64 flags;
+            u64 cursor;
         } list;
+
+        // EACH PART IS A GET RESPONSE OF ITS OWN
+        struct {
+            struct response *parts;
+            usize count;
+            u64 accept;
+            u64 flags;
+        } get_multi;
+
+        struct {
+            struct part_stat *parts;
+            usize count;
+        } stat;
     };
 };
 
-int make_response(char const *root, struct users const *users, struct request const *req, struct response *res);
+int has_get_body(byte type);
+int make_response(struct users const *users, struct user *user, struct request const *req, struct response *res);
+int commit_put(int dir, struct request const *req, struct response *res);
+usize serialize_response_header(struct response const *res, byte *buf);
+usize multi_part_header_len(struct response const *part);
+usize serialize_multi_part_header(struct response const *part, byte *buf);
 int serialize_response(struct response const *res, byte *buf);
 usize responselen(struct response const *res);
+char const *entry_name(struct response const *res, usize i);
 void print_response(struct response const *res);
+void drop_response(struct response *res);
 char const *status_to_string(byte status);
+int recv_response(int fd, struct response *res);
 int recv_put_response(int fd, struct response *res);
 int recv_get_response(int fd, struct response *res);
+int recv_get_response_to(int fd, struct body_sink const *sink, struct response *res);
 int recv_list_response(int fd, struct response *res);
 int recv_mkdir_response(int fd, struct response *res);
+int recv_get_multi_response(int fd, struct response *res);
+int recv_get_range_response(int fd, struct response *res);
+int recv_get_range_response_to(int fd, struct body_sink const *sink, struct response *res);
+int recv_login_response(int fd, struct response *res);
+int recv_stat_response(int fd, struct response *res);
 
 #endif
@@ -0,0 +1,133 @@
+#include "slab.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_END        ((u32)-1)
+#define SLAB_ALIGN      16
+
+// BOOKKEEPING STORED IN FRONT OF EVERY ENTRY
+struct slab_slot {
+    u32 next_free;
+    u16 generation;
+    u16 live;
+};
+
+struct slab_slot *slab_slot(struct slab const *s, usize index) {
+    return (struct slab_slot *)&s->chunks[index / SLAB_CHUNK][(index % SLAB_CHUNK) * s->slot_size];
+}
+
+u64 make_slab_handle(usize index, u16 generation) {
+    return ((u64)generation << SLAB_INDEX_BITS) | index;
+}
+
+void *slot_entry(struct slab_slot *slot) {
+    return (byte *)slot + SLAB_ALIGN;
+}
+
+void init_slab(struct slab *s, usize entry_size) {
+    memset(s, 0, sizeof(struct slab));
+    s->entry_size = entry_size;
+    s->slot_size = SLAB_ALIGN + (entry_size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+    s->free_head = SLAB_END;
+}
+
+void drop_slab(struct slab *s) {
+    for (usize i = 0; i < s->num_chunks; ++i) {
+        free(s->chunks[i]);
+    }
+    free(s->chunks);
+    memset(s, 0, sizeof(struct slab));
+    s->free_head = SLAB_END;
+}
+
+// ADDS A CHUNK OF FREE SLOTS, KEEPING THE LOWEST INDEX AT THE HEAD OF THE LIST
+int grow_slab(struct slab *s) {
+    if (s->capacity + SLAB_CHUNK > SLAB_MAX_ENTRIES) {
+        return -1;
+    }
+    byte **chunks = realloc(s->chunks, (s->num_chunks + 1) * sizeof(byte *));
+    if (!chunks) {
+        return -1;
+    }
+    s->chunks = chunks;
+    byte *chunk = calloc(SLAB_CHUNK, s->slot_size);
+    if (!chunk) {
+        return -1;
+    }
+    s->chunks[s->num_chunks] = chunk;
+    s->num_chunks += 1;
+
+    usize first = s->capacity;
+    s->capacity += SLAB_CHUNK;
+    for (usize i = s->capacity; i > first; --i) {
+        struct slab_slot *slot = slab_slot(s, i - 1);
+        slot->next_free = s->free_head;
+        s->free_head = i - 1;
+    }
+    TRACE("slab grew to %zu entries", s->capacity);
+    return 0;
+}
+
+// RETURNS A ZEROED ENTRY AND ITS HANDLE, OR NULL IF THE TABLE CAN'T GROW
+void *slab_alloc(struct slab *s, u64 *handle) {
+    if (s->free_head == SLAB_END && grow_slab(s) != 0) {
+        return NULL;
+    }
+
+    usize index = s->free_head;
+    struct slab_slot *slot = slab_slot(s, index);
+    s->free_head = slot->next_free;
+    slot->next_free = SLAB_END;
+    slot->live = 1;
+    s->used += 1;
+
+    void *entry = slot_entry(slot);
+    memset(entry, 0, s->entry_size);
+    *handle = make_slab_handle(index, slot->generation);
+    return entry;
+}
+
+void slab_free(struct slab *s, u64 handle) {
+    usize index = handle & (SLAB_MAX_ENTRIES - 1);
+    struct slab_slot *slot = slab_slot(s, index);
+    if (slab_get(s, handle) == NULL) {
+        TRACE("freeing stale slab handle %llx", (unsigned long long)handle);
+        return;
+    }
+    slot->live = 0;
+    slot->generation += 1;
+    slot->next_free = s->free_head;
+    s->free_head = index;
+    s->used -= 1;
+}
+
+// RESOLVES A HANDLE, OR RETURNS NULL IF ITS ENTRY HAS SINCE BEEN FREED
+void *slab_get(struct slab const *s, u64 handle) {
+    if (handle >> SLAB_HANDLE_BITS) {
+        return NULL;
+    }
+    usize index = handle & (SLAB_MAX_ENTRIES - 1);
+    if (index >= s->capacity) {
+        return NULL;
+    }
+    struct slab_slot *slot = slab_slot(s, index);
+    if (!slot->live || slot->generation != (u16)(handle >> SLAB_INDEX_BITS)) {
+        return NULL;
+    }
+    return slot_entry(slot);
+}
+
+// RETURNS THE LIVE ENTRY AT index AND ITS HANDLE, OR NULL IF THE SLOT IS FREE.
+// USED TO WALK EVERY ENTRY AT SHUTDOWN.
+void *slab_entry(struct slab const *s, usize index, u64 *handle) {
+    if (index >= s->capacity) {
+        return NULL;
+    }
+    struct slab_slot *slot = slab_slot(s, index);
+    if (!slot->live) {
+        return NULL;
+    }
+    *handle = make_slab_handle(index, slot->generation);
+    return slot_entry(slot);
+}
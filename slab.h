@@ -0,0 +1,36 @@
+#ifndef slab_h
+#define slab_h
+#include "typedefs.h"
+
+#define SLAB_CHUNK          1024
+#define SLAB_INDEX_BITS     24
+#define SLAB_MAX_ENTRIES    (1 << SLAB_INDEX_BITS)
+// HANDLES FIT IN THE LOW SLAB_HANDLE_BITS OF A u64, LEAVING THE REST FREE
+// FOR CALLERS TO PACK THEIR OWN TAGS INTO io_uring user_data
+#define SLAB_HANDLE_BITS    40
+#define SLAB_NO_HANDLE      ((u64)-1)
+
+// GROWABLE TABLE OF FIXED-SIZE ENTRIES. ENTRIES LIVE IN CHUNKS THAT ARE NEVER
+// MOVED, SO POINTERS TO THEM STAY VALID AS THE TABLE GROWS. EACH ENTRY IS
+// ADDRESSED BY A HANDLE OF (GENERATION << SLAB_INDEX_BITS) | INDEX; THE
+// GENERATION IS BUMPED WHENEVER THE SLOT IS FREED, SO A HANDLE LEFT OVER FROM
+// AN OLD ENTRY NEVER RESOLVES TO A NEW ONE. FREE SLOTS ARE KEPT ON A LIST AND
+// REUSED BEFORE THE TABLE GROWS.
+struct slab {
+    usize entry_size;
+    usize slot_size;
+    usize capacity;
+    usize used;
+    byte **chunks;
+    usize num_chunks;
+    u32 free_head;
+};
+
+void init_slab(struct slab *s, usize entry_size);
+void drop_slab(struct slab *s);
+void *slab_alloc(struct slab *s, u64 *handle);
+void slab_free(struct slab *s, u64 handle);
+void *slab_get(struct slab const *s, u64 handle);
+void *slab_entry(struct slab const *s, usize index, u64 *handle);
+
+#endif
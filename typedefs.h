@@ -3,7 +3,9 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef uint8_t byte;
 typedef size_t usize;
 typedef ssize_t isize;
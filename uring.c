@@ -0,0 +1,867 @@
+#include "uring.h"
+#include "net.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+
+// user_data OF EVERY SUBMISSION IS (KIND << 56) | (TAG << 40) | HANDLE, WHERE
+// HANDLE IS THE CONNECTION'S SLAB HANDLE. UPLOAD WRITES TAG THE RECEIVE
+// BUFFER THEY WRITE FROM, TO RECYCLE IT ON COMPLETION.
+enum {
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_SPLICE_IN,
+    URING_SPLICE_OUT,
+    URING_UPLOAD,
+    URING_CANCEL,
+    URING_COMPLETIONS,
+};
+
+#define NO_RECV_BUFFER  0xffff
+
+#define HANDLE_MASK     (((u64)1 << SLAB_HANDLE_BITS) - 1)
+
+u64 make_user_data(u32 kind, u64 handle, unsigned short tag) {
+    return ((u64)kind << 56) | ((u64)tag << SLAB_HANDLE_BITS) | (handle & HANDLE_MASK);
+}
+
+int ring_setup(struct ring *r, unsigned entries) {
+    memset(r, 0, sizeof(struct ring));
+    struct io_uring_params p = {0};
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        r->fd = -1;
+        return -1;
+    }
+
+    r->entries = p.sq_entries;
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_len > r->sq_map_len) {
+            r->sq_map_len = r->cq_map_len;
+        }
+        r->cq_map_len = 0;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+    if (r->cq_map_len == 0) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            munmap(r->sq_map, r->sq_map_len);
+            close(r->fd);
+            r->fd = -1;
+            return -1;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (r->cq_map_len != 0) {
+            munmap(r->cq_map, r->cq_map_len);
+        }
+        munmap(r->sq_map, r->sq_map_len);
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+
+    byte *sq = r->sq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    byte *cq = r->cq_map;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void ring_drop(struct ring *r) {
+    if (r->fd < 0) {
+        return;
+    }
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_map_len != 0) {
+        munmap(r->cq_map, r->cq_map_len);
+    }
+    munmap(r->sq_map, r->sq_map_len);
+    close(r->fd);
+    memset(r, 0, sizeof(struct ring));
+    r->fd = -1;
+}
+
+// SUBMITS QUEUED ENTRIES, AND IF wait IS SET BLOCKS FOR AT LEAST ONE COMPLETION
+int ring_enter(struct ring *r, int wait) {
+    int n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait ? 1 : 0,
+                    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n < 0) {
+        return -1;
+    }
+    r->to_submit -= n;
+    return 0;
+}
+
+struct io_uring_sqe *ring_sqe(struct ring *r) {
+    unsigned tail = *r->sq_tail;
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->entries) {
+        // SUBMISSION QUEUE FULL, FLUSH IT TO THE KERNEL
+        while (ring_enter(r, 0) != 0 && errno == EINTR) {
+        }
+    }
+
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit += 1;
+    return sqe;
+}
+
+int setup_recv_buffers(struct uring_loop *loop) {
+    struct recv_buffers *b = &loop->buffers;
+    usize ring_len = RECV_BUFFERS * sizeof(struct io_uring_buf);
+    void *ring_mem = NULL;
+    if (posix_memalign(&ring_mem, sysconf(_SC_PAGESIZE), ring_len) != 0) {
+        return -1;
+    }
+    memset(ring_mem, 0, ring_len);
+    b->ring = ring_mem;
+    b->mem = malloc(RECV_BUFFERS * RECV_BUFFER_LEN);
+    b->tail = 0;
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (u64)(usize)ring_mem;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = 0;
+    int err = syscall(__NR_io_uring_register, loop->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    if (err != 0) {
+        free(b->ring);
+        free(b->mem);
+        memset(b, 0, sizeof(struct recv_buffers));
+        return -1;
+    }
+
+    for (unsigned short bid = 0; bid < RECV_BUFFERS; ++bid) {
+        struct io_uring_buf *buf = &b->ring->bufs[b->tail & (RECV_BUFFERS - 1)];
+        buf->addr = (u64)(usize)&b->mem[(usize)bid * RECV_BUFFER_LEN];
+        buf->len = RECV_BUFFER_LEN;
+        buf->bid = bid;
+        b->tail += 1;
+    }
+    __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void recycle_recv_buffer(struct recv_buffers *b, unsigned short bid) {
+    struct io_uring_buf *buf = &b->ring->bufs[b->tail & (RECV_BUFFERS - 1)];
+    buf->addr = (u64)(usize)&b->mem[(usize)bid * RECV_BUFFER_LEN];
+    buf->len = RECV_BUFFER_LEN;
+    buf->bid = bid;
+    b->tail += 1;
+    __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+void arm_accept(struct uring_loop *loop) {
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->tcp_listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = make_user_data(URING_ACCEPT, 0, 0);
+}
+
+void arm_completions(struct uring_loop *loop) {
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->completions.eventfd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = make_user_data(URING_COMPLETIONS, 0, 0);
+}
+
+void arm_recv(struct uring_loop *loop, struct uring_connection *uc) {
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc->conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = make_user_data(URING_RECV, uc->conn.handle, 0);
+    uc->receiving = 1;
+}
+
+void submit_send(struct uring_loop *loop, struct uring_connection *uc) {
+    struct connection *c = &uc->conn;
+    if (uc->sending || c->hup || c->write.end - c->write.start == 0) {
+        return;
+    }
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (u64)(usize)&c->write.buf[c->write.start];
+    sqe->len = c->write.end - c->write.start;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = make_user_data(URING_SEND, c->handle, 0);
+    uc->sending = 1;
+}
+
+// GET BODIES GO PART FILE -> PIPE -> SOCKET WITH TWO SPLICES PER CHUNK, SO
+// THEY ARE NEVER COPIED THROUGH USERSPACE.
+void submit_splice(struct uring_loop *loop, struct uring_connection *uc, u32 kind,
+                   int fd_in, u64 off_in, int fd_out, usize len)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = off_in;
+    sqe->fd = fd_out;
+    sqe->off = (u64)-1;
+    sqe->len = len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->user_data = make_user_data(kind, uc->conn.handle, 0);
+    uc->splicing = 1;
+}
+
+void submit_upload_write(struct uring_loop *loop, struct uring_connection *uc,
+                         byte const *buf, usize len, unsigned short bid)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = uc->conn.upload.job->res.fd;
+    sqe->addr = (u64)(usize)buf;
+    sqe->len = len;
+    sqe->off = uc->upload_offset;
+    sqe->user_data = make_user_data(URING_UPLOAD, uc->conn.handle, bid);
+    uc->upload_offset += len;
+    uc->upload_writes += 1;
+}
+
+// STOPS RECEIVING WHILE TOO MUCH IS BUFFERED, TOO MANY UPLOAD WRITES ARE
+// OUTSTANDING OR THE PEER ISN'T TAKING ITS RESPONSES, AND STARTS AGAIN ONCE
+// THAT HAS DRAINED. KEEPS THE MEMORY HELD BY ONE CONNECTION BOUNDED NO MATTER
+// HOW FAST ITS PEER SENDS. WHILE THE PROCESS IS OVER ITS MEMORY BUDGET, BUSY
+// CONNECTIONS STOP RECEIVING TOO; THEY ARE CHECKED AGAIN AS THEIR JOBS FINISH.
+void update_recv(struct uring_loop *loop, struct uring_connection *uc) {
+    struct connection *c = &uc->conn;
+    int busy = c->pipeline.len > 0 || c->download.job;
+    int full = c->read.end - c->read.parse_idx >= URING_READ_BUF_MAX
+               || uc->upload_writes >= UPLOAD_MAX_WRITES
+               || write_backlogged(c)
+               || (busy && over_budget(&loop->buffer_pool));
+    if (full && !uc->recv_paused) {
+        uc->recv_paused = 1;
+        if (uc->receiving) {
+            struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = make_user_data(URING_RECV, c->handle, 0);
+            sqe->user_data = make_user_data(URING_CANCEL, c->handle, 0);
+        }
+    } else if (!full && uc->recv_paused) {
+        uc->recv_paused = 0;
+        if (!uc->receiving && !c->hup) {
+            arm_recv(loop, uc);
+        }
+    }
+}
+
+void close_uring_connection(struct uring_loop *loop, struct uring_connection *uc) {
+    TRACE("closing %d", uc->conn.fd);
+    u64 handle = uc->conn.handle;
+    abandon_pipeline(&uc->conn);
+    free(uc->upload_chunk);
+    if (uc->pipe[0] > 0) {
+        close(uc->pipe[0]);
+        close(uc->pipe[1]);
+    }
+    drop_connection(&uc->conn);
+    memset(uc, 0, sizeof(struct uring_connection));
+    slab_free(&loop->connections, handle);
+}
+
+// CLOSES A HUNG UP CONNECTION ONCE NOTHING IN FLIGHT STILL REFERENCES IT
+void maybe_close(struct uring_loop *loop, struct uring_connection *uc) {
+    struct connection *c = &uc->conn;
+    if (c->hup && !uc->splicing && !uc->upload_writes) {
+        abandon_pipeline(c);
+    }
+    if (c->hup && !c->pending && !uc->receiving && !uc->sending && !uc->splicing && !uc->upload_writes) {
+        close_uring_connection(loop, uc);
+    }
+}
+
+void dispatch_uring_requests(struct uring_loop *loop, struct uring_connection *uc) {
+    struct connection *c = &uc->conn;
+    while (can_dispatch(c)) {
+        struct job *j = calloc(1, sizeof(struct job));
+        if (parse_request(c, &j->req) != 1) {
+            free(j);
+            return;
+        }
+
+        j->user = authenticate(c, loop->pool->users, &j->req);
+        j->completions = &loop->completions;
+        j->context = uc;
+        if (j->req.type == PUT) {
+            c->upload.active = 1;
+            c->upload.remaining = j->req.put.file.len;
+        }
+        push_pipeline(c, j);
+        submit_job(loop->pool, j);
+    }
+}
+
+// QUEUES EVERY RESPONSE THAT IS READY ONCE THE WRITE BUFFER ISN'T BORROWED BY
+// AN IN-FLIGHT SEND, AND SENDS THEM TOGETHER. A GET WITH A BODY ON DISK ONLY
+// QUEUES ITS HEADER AND LEAVES THE BODY TO pump_download. ANSWERING REQUESTS
+// CAN LIFT BACKPRESSURE, SO RECEIVING IS RECHECKED TOO.
+void flush_responses(struct uring_loop *loop, struct uring_connection *uc) {
+    if (!uc->sending) {
+        if (queue_responses(&uc->conn) > 0) {
+            // MAKES ROOM IN THE PIPELINE FOR REQUESTS ALREADY BUFFERED
+            dispatch_uring_requests(loop, uc);
+        }
+        submit_send(loop, uc);
+    }
+    update_recv(loop, uc);
+}
+
+// FINISHES A PUT ONCE ITS WHOLE BODY HAS BEEN WRITTEN, REPLACING THE PART
+// WITH IT UNLESS A WRITE FAILED, OR ABANDONS IT IF THE CONNECTION WENT AWAY.
+void settle_upload(struct uring_loop *loop, struct uring_connection *uc) {
+    struct connection *c = &uc->conn;
+    struct job *j = c->upload.job;
+    if (!j || uc->upload_writes > 0 || (c->upload.remaining > 0 && !c->hup)) {
+        return;
+    }
+    if (c->hup) {
+        maybe_close(loop, uc);
+        return;
+    }
+
+    TRACE("upload on %d complete", c->fd);
+    if (j->res.fd > 0 && j->res.status == SUCCESS) {
+        commit_put(user_dir(loop->pool->users, j->user), &j->req, &j->res);
+    }
+    j->state = JOB_DONE;
+    c->upload.job = NULL;
+    c->upload.active = 0;
+    uc->upload_offset = 0;
+    dispatch_uring_requests(loop, uc);
+    update_recv(loop, uc);
+    flush_responses(loop, uc);
+}
+
+// STARTS STREAMING A PUT BODY ONCE THE WORKER HAS OPENED THE PART FILE. BYTES
+// THAT ARRIVED WHILE IT WAS OPENING ARE WRITTEN FROM A COPY; EVERYTHING AFTER
+// IS WRITTEN STRAIGHT FROM THE RECEIVE BUFFERS IN handle_recv.
+void start_upload(struct uring_loop *loop, struct uring_connection *uc, struct job *j) {
+    struct connection *c = &uc->conn;
+    c->upload.job = j;
+    uc->upload_offset = 0;
+
+    usize buffered = c->read.end - c->read.parse_idx;
+    if (buffered > c->upload.remaining) {
+        buffered = c->upload.remaining;
+    }
+    if (buffered > 0) {
+        if (j->res.fd > 0) {
+            uc->upload_chunk = malloc(buffered);
+            memcpy(uc->upload_chunk, &c->read.buf[c->read.parse_idx], buffered);
+            submit_upload_write(loop, uc, uc->upload_chunk, buffered, NO_RECV_BUFFER);
+        }
+        consume_read(c, buffered);
+        c->upload.remaining -= buffered;
+    }
+
+    update_recv(loop, uc);
+    settle_upload(loop, uc);
+}
+
+void handle_upload_write(struct uring_loop *loop, struct uring_connection *uc, unsigned short bid, int res) {
+    struct connection *c = &uc->conn;
+    uc->upload_writes -= 1;
+    if (bid == NO_RECV_BUFFER) {
+        free(uc->upload_chunk);
+        uc->upload_chunk = NULL;
+    } else {
+        recycle_recv_buffer(&loop->buffers, bid);
+    }
+
+    if (res < 0 && c->upload.job->res.status == SUCCESS) {
+        TRACE("error writing upload on %d: %s", c->fd, strerror(-res));
+        c->upload.job->res.status = INVALID_PATH;
+    }
+
+    update_recv(loop, uc);
+    settle_upload(loop, uc);
+}
+
+// SENDS A GET BODY ONCE ITS HEADER HAS GONE OUT, ONE PIPE-SIZED CHUNK AT A
+// TIME, AND TAKES THE NEXT REQUEST WHEN IT'S DONE.
+void pump_download(struct uring_loop *loop, struct uring_connection *uc) {
+    struct connection *c = &uc->conn;
+    struct job *j = c->download.job;
+    if (!j || c->hup || uc->sending || uc->splicing || c->write.end - c->write.start > 0) {
+        return;
+    }
+
+    if (uc->pipe_len > 0) {
+        submit_splice(loop, uc, URING_SPLICE_OUT, uc->pipe[0], (u64)-1, c->fd, uc->pipe_len);
+        return;
+    }
+
+    if (c->download.remaining == 0) {
+        TRACE("download on %d complete", c->fd);
+        if (next_download(c)) {
+            // ANOTHER GET_MULTI PART, SEND ITS HEADER FIRST
+            submit_send(loop, uc);
+            return;
+        }
+        dispatch_uring_requests(loop, uc);
+        flush_responses(loop, uc);
+        return;
+    }
+
+    if (uc->pipe[0] == 0) {
+        if (pipe2(uc->pipe, O_CLOEXEC) != 0) {
+            TRACE("pipe2: %s", system_error());
+            c->hup = 1;
+            maybe_close(loop, uc);
+            return;
+        }
+        int size = fcntl(uc->pipe[1], F_SETPIPE_SZ, URING_PIPE_SIZE);
+        uc->pipe_size = size > 0 ? size : fcntl(uc->pipe[1], F_GETPIPE_SZ);
+    }
+    usize len = c->download.remaining < uc->pipe_size ? c->download.remaining : uc->pipe_size;
+    submit_splice(loop, uc, URING_SPLICE_IN, c->download.fd, c->download.offset, uc->pipe[1], len);
+}
+
+void handle_splice(struct uring_loop *loop, struct uring_connection *uc, u32 kind, int res) {
+    struct connection *c = &uc->conn;
+    uc->splicing = 0;
+    if (res <= 0) {
+        // HEADER IS ALREADY OUT, NO WAY TO RECOVER FRAMING
+        TRACE("splice on %d failed: %s", c->fd, res < 0 ? strerror(-res) : "eof");
+        c->hup = 1;
+        maybe_close(loop, uc);
+        return;
+    }
+
+    if (kind == URING_SPLICE_IN) {
+        uc->pipe_len = res;
+        c->download.offset += res;
+        c->download.remaining -= res;
+    } else {
+        TRACE("%d <- splice %d", c->fd, res);
+        uc->pipe_len -= res;
+    }
+    pump_download(loop, uc);
+    maybe_close(loop, uc);
+}
+
+void handle_accept(struct uring_loop *loop, struct io_uring_cqe const *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        arm_accept(loop);
+    }
+    if (cqe->res < 0) {
+        TRACE("accept: %s", strerror(-cqe->res));
+        return;
+    }
+
+    int fd = cqe->res;
+    u64 handle;
+    struct uring_connection *uc = slab_alloc(&loop->connections, &handle);
+    if (!uc) {
+        TRACE("no room for connection %d", fd);
+        close(fd);
+        return;
+    }
+
+    uc->conn = (struct connection){
+        .fd = fd,
+        .handle = handle,
+        .buffers = &loop->buffer_pool,
+    };
+    arm_recv(loop, uc);
+}
+
+void handle_recv(struct uring_loop *loop, struct uring_connection *uc, struct io_uring_cqe const *cqe) {
+    struct connection *c = &uc->conn;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uc->receiving = 0;
+    }
+
+    if (cqe->res > 0) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        byte const *src = &loop->buffers.mem[(usize)bid * RECV_BUFFER_LEN];
+        usize n = cqe->res;
+        TRACE("%d -> %zu", c->fd, n);
+
+        int held = 0;
+        if (c->upload.job) {
+            // PUT BODY, WRITE IT OUT FROM THE RECEIVE BUFFER ITSELF
+            usize body = n < c->upload.remaining ? n : c->upload.remaining;
+            if (body > 0 && c->upload.job->res.fd > 0) {
+                submit_upload_write(loop, uc, src, body, bid);
+                held = 1;
+            }
+            c->upload.remaining -= body;
+            src += body;
+            n -= body;
+        }
+        if (n > 0) {
+            // ALREADY RECEIVED, SO IT HAS TO BE KEPT; update_recv BOUNDS HOW
+            // MUCH CAN PILE UP
+            reserve_read(c, n, (usize)-1, 1);
+            memcpy(&c->read.buf[c->read.end], src, n);
+            c->read.end += n;
+        }
+        if (!held) {
+            recycle_recv_buffer(&loop->buffers, bid);
+        }
+
+        settle_upload(loop, uc);
+        dispatch_uring_requests(loop, uc);
+        update_recv(loop, uc);
+        if (!uc->receiving && !uc->recv_paused && !c->hup) {
+            arm_recv(loop, uc);
+        }
+    } else if (cqe->res == -ENOBUFS || (cqe->res == -ECANCELED && !c->hup)) {
+        // OUT OF PROVIDED BUFFERS, OR PAUSED BY update_recv
+        if (!uc->receiving && !uc->recv_paused && !c->hup) {
+            arm_recv(loop, uc);
+        }
+    } else {
+        TRACE("%d -> rdhup", c->fd);
+        c->hup = 1;
+        settle_upload(loop, uc);
+        maybe_close(loop, uc);
+    }
+}
+
+void handle_send(struct uring_loop *loop, struct uring_connection *uc, int res) {
+    struct connection *c = &uc->conn;
+    uc->sending = 0;
+    if (res < 0) {
+        TRACE("send on %d: %s", c->fd, strerror(-res));
+        c->hup = 1;
+    } else {
+        TRACE("%d <- %d", c->fd, res);
+        c->write.start += res;
+        release_write(c);
+    }
+
+    dispatch_uring_requests(loop, uc);
+    flush_responses(loop, uc);
+    pump_download(loop, uc);
+    maybe_close(loop, uc);
+}
+
+void handle_completions(struct uring_loop *loop, struct io_uring_cqe const *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        arm_completions(loop);
+    }
+
+    // HAND EVERY JOB BACK FIRST, THEN FLUSH EACH CONNECTION ONCE, SO
+    // RESPONSES FINISHED IN THE SAME BATCH GO OUT IN ONE SEND
+    struct uring_connection *ready = NULL;
+    struct job *j = take_completions(&loop->completions);
+    while (j) {
+        struct job *next = j->next;
+        j->next = NULL;
+        struct uring_connection *uc = j->context;
+        struct connection *c = &uc->conn;
+        c->pending -= 1;
+        if (c->hup) {
+            // ALREADY UNLINKED BY abandon_pipeline
+            drop_job(j);
+            maybe_close(loop, uc);
+        } else if (j->req.type == PUT) {
+            j->state = JOB_STREAMING;
+            start_upload(loop, uc, j);
+        } else {
+            j->state = JOB_DONE;
+            if (!c->ready) {
+                c->ready = 1;
+                c->next_ready = ready ? &ready->conn : NULL;
+                ready = uc;
+            }
+        }
+        j = next;
+    }
+
+    while (ready) {
+        struct uring_connection *uc = ready;
+        ready = (struct uring_connection *)uc->conn.next_ready;
+        uc->conn.ready = 0;
+        uc->conn.next_ready = NULL;
+        flush_responses(loop, uc);
+        pump_download(loop, uc);
+        maybe_close(loop, uc);
+    }
+}
+
+void *run_uring_loop(void *arg) {
+    struct uring_loop *loop = arg;
+    struct ring *r = &loop->ring;
+
+    TRACE("starting io_uring event loop");
+    arm_accept(loop);
+    arm_completions(loop);
+    while (1) {
+        int err = ring_enter(r, 1);
+        if (err != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TRACE("io_uring_enter: %s", system_error());
+            break;
+        }
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = r->cqes[head & *r->cq_mask];
+            head += 1;
+            // RELEASE THE SLOT FIRST, HANDLERS MAY SUBMIT AND FLUSH
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+            u32 kind = cqe.user_data >> 56;
+            unsigned short tag = cqe.user_data >> SLAB_HANDLE_BITS;
+            struct uring_connection *uc = NULL;
+            if (kind != URING_ACCEPT && kind != URING_COMPLETIONS && kind != URING_CANCEL) {
+                // EVERY OPERATION HOLDS ITS CONNECTION OPEN, SO THIS ONLY
+                // FAILS IF THAT BOOKKEEPING IS BROKEN
+                uc = slab_get(&loop->connections, cqe.user_data & HANDLE_MASK);
+                if (!uc) {
+                    TRACE("completion for closed connection, kind %u", kind);
+                    continue;
+                }
+            }
+            switch (kind) {
+            case URING_ACCEPT:
+                handle_accept(loop, &cqe);
+                break;
+            case URING_COMPLETIONS:
+                handle_completions(loop, &cqe);
+                break;
+            case URING_RECV:
+                handle_recv(loop, uc, &cqe);
+                break;
+            case URING_SEND:
+                handle_send(loop, uc, cqe.res);
+                break;
+            case URING_SPLICE_IN:
+            case URING_SPLICE_OUT:
+                handle_splice(loop, uc, kind, cqe.res);
+                break;
+            case URING_UPLOAD:
+                handle_upload_write(loop, uc, tag, cqe.res);
+                break;
+            }
+        }
+    }
+
+    TRACE("io_uring event loop exiting...");
+    return NULL;
+}
+
+// OPCODES THE LOOP SUBMITS
+byte const uring_ops[] = {
+    IORING_OP_ACCEPT,
+    IORING_OP_ASYNC_CANCEL,
+    IORING_OP_POLL_ADD,
+    IORING_OP_RECV,
+    IORING_OP_SEND,
+    IORING_OP_SPLICE,
+    IORING_OP_WRITE,
+};
+
+// SAYS WHETHER THE KERNEL HAS EVERYTHING THE LOOP USES, NOT JUST io_uring
+// ITSELF: EVERY OPCODE IN uring_ops, A PROVIDED BUFFER RING, AND MULTISHOT
+// ACCEPT AND RECV. THOSE TWO ARE FLAGS RATHER THAN OPCODES, SO THE PROBE
+// CAN'T SEE THEM: THEY ARE SUBMITTED FOR REAL ON A THROWAWAY LISTENER AND
+// SOCKET PAIR, WHICH A KERNEL WITHOUT THEM FAILS WITH EINVAL STRAIGHT AWAY.
+// SETS errno TO SAY WHAT IS MISSING.
+int uring_available() {
+    struct ring r;
+    if (ring_setup(&r, 8) != 0) {
+        return 0;
+    }
+    int available = 0;
+    int listener = -1;
+    int pair[2] = {-1, -1};
+    int registered = 0;
+    struct io_uring_buf_reg reg = {0};
+    void *buf_ring = NULL;
+    usize probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_len);
+
+    if (syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        TRACE("io_uring probe: %s", system_error());
+        goto cleanup;
+    }
+    for (usize i = 0; i < sizeof(uring_ops); ++i) {
+        byte op = uring_ops[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            TRACE("io_uring lacks opcode %u", op);
+            errno = EOPNOTSUPP;
+            goto cleanup;
+        }
+    }
+
+    usize page = sysconf(_SC_PAGESIZE);
+    if (posix_memalign(&buf_ring, page, page) != 0) {
+        goto cleanup;
+    }
+    memset(buf_ring, 0, page);
+    // ONE BUFFER, OR THE RECV FAILS WITH ENOBUFS RATHER THAN WAITING
+    byte spare[64];
+    struct io_uring_buf_ring *bufs = buf_ring;
+    bufs->bufs[0].addr = (u64)(usize)spare;
+    bufs->bufs[0].len = sizeof(spare);
+    bufs->bufs[0].bid = 0;
+    __atomic_store_n(&bufs->tail, 1, __ATOMIC_RELEASE);
+    reg.ring_addr = (u64)(usize)buf_ring;
+    reg.ring_entries = 1;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        TRACE("io_uring provided buffer ring: %s", system_error());
+        goto cleanup;
+    }
+    registered = 1;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+        || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0)
+    {
+        goto cleanup;
+    }
+    struct io_uring_sqe *sqe = ring_sqe(&r);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_ACCEPT;
+    sqe = ring_sqe(&r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = pair[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_RECV;
+    if (ring_enter(&r, 0) != 0) {
+        goto cleanup;
+    }
+    // NEITHER HAS ANYTHING TO DO, SO ANY COMPLETION IS A REJECTION
+    unsigned head = *r.cq_head;
+    unsigned tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+        struct io_uring_cqe const *cqe = &r.cqes[head & *r.cq_mask];
+        TRACE("io_uring multishot %s: %s", cqe->user_data == URING_ACCEPT ? "accept" : "recv", strerror(-cqe->res));
+        errno = -cqe->res;
+        goto cleanup;
+    }
+    available = 1;
+
+cleanup:;
+    int saved = errno;
+    if (listener >= 0) {
+        close(listener);
+    }
+    if (pair[0] >= 0) {
+        close(pair[0]);
+        close(pair[1]);
+    }
+    if (registered) {
+        syscall(__NR_io_uring_register, r.fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    ring_drop(&r);
+    free(buf_ring);
+    free(probe);
+    errno = saved;
+    return available;
+}
+
+int start_uring_loop(struct uring_loop *loop, char const *port, int reuseport) {
+    init_slab(&loop->connections, sizeof(struct uring_connection));
+
+    // THE RING WAITS ON THE LISTENER ITSELF, SO IT STAYS BLOCKING
+    loop->tcp_listener = make_tcp_listener("127.0.0.1", port, reuseport);
+    if (loop->tcp_listener == -1) {
+        println("error creating tcp listening socket: %s", system_error());
+        return -1;
+    }
+
+    int err = ring_setup(&loop->ring, URING_ENTRIES);
+    if (err != 0) {
+        println("unable to create io_uring instance: %s", system_error());
+        return -1;
+    }
+
+    err = setup_recv_buffers(loop);
+    if (err != 0) {
+        println("unable to register io_uring receive buffers: %s", system_error());
+        return -1;
+    }
+
+    err = init_completions(&loop->completions);
+    if (err != 0) {
+        println("unable to create completion eventfd: %s", system_error());
+        return -1;
+    }
+
+    err = pthread_create(&loop->thread, NULL, run_uring_loop, loop);
+    if (err != 0) {
+        errno = err;
+        println("unable to start event loop thread: %s", system_error());
+        return -1;
+    }
+
+    return 0;
+}
+
+void drop_uring_loop(struct uring_loop *loop) {
+    for (usize i = 0; i < loop->connections.capacity; ++i) {
+        u64 handle;
+        struct uring_connection *uc = slab_entry(&loop->connections, i, &handle);
+        if (uc) {
+            close_uring_connection(loop, uc);
+        }
+    }
+    drop_slab(&loop->connections);
+    drop_buffer_pool(&loop->buffer_pool);
+    if (loop->completions.eventfd > 0) {
+        drop_completions(&loop->completions);
+    }
+    ring_drop(&loop->ring);
+    free(loop->buffers.ring);
+    free(loop->buffers.mem);
+    memset(&loop->buffers, 0, sizeof(struct recv_buffers));
+    close(loop->tcp_listener);
+}
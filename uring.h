@@ -0,0 +1,77 @@
+#ifndef uring_h
+#define uring_h
+#include "typedefs.h"
+#include "connection.h"
+#include "pool.h"
+#include "slab.h"
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES           256
+#define RECV_BUFFERS            256
+#define RECV_BUFFER_LEN         16384
+#define URING_PIPE_SIZE         (1 << 20)
+#define URING_READ_BUF_MAX      65536
+#define UPLOAD_MAX_WRITES       32
+
+// MINIMAL io_uring BINDING: THE MMAPPED SUBMISSION AND COMPLETION RINGS.
+struct ring {
+    int fd;
+    unsigned entries;
+    unsigned to_submit;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    usize sq_map_len;
+    void *cq_map;
+    usize cq_map_len;
+    usize sqes_len;
+};
+
+// PROVIDED BUFFER RING THAT MULTISHOT RECV PICKS RECEIVE BUFFERS FROM.
+struct recv_buffers {
+    struct io_uring_buf_ring *ring;
+    byte *mem;
+    unsigned short tail;
+};
+
+struct uring_connection {
+    struct connection conn;
+    // PIPE GET BODIES ARE SPLICED THROUGH
+    int pipe[2];
+    usize pipe_size;
+    usize pipe_len;
+    int splicing;
+    int sending;
+    int receiving;
+    int recv_paused;
+    // PUT BODY WRITES OUTSTANDING ON THE RING
+    u64 upload_offset;
+    int upload_writes;
+    byte *upload_chunk;
+};
+
+struct uring_loop {
+    pthread_t thread;
+    int tcp_listener;
+    struct ring ring;
+    struct recv_buffers buffers;
+    struct pool *pool;
+    struct completions completions;
+    struct buffer_pool buffer_pool;
+    // SUBMISSIONS CARRY THE CONNECTION'S SLAB HANDLE IN user_data
+    struct slab connections;
+};
+
+int uring_available();
+int start_uring_loop(struct uring_loop *loop, char const *port, int reuseport);
+void drop_uring_loop(struct uring_loop *loop);
+
+#endif
@@ -0,0 +1,147 @@
+#include "users.h"
+#include "util.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+usize *probe_users(struct users const *u, usize *slots, usize num_slots, char const *username) {
+    usize i = hash_name(username, strlen(username)) & (num_slots - 1);
+    while (slots[i] && !strings_equal(u->users[slots[i] - 1].username, username)) {
+        i = (i + 1) & (num_slots - 1);
+    }
+    return &slots[i];
+}
+
+// ADDS AN ACCOUNT, OR REPLACES THE PASSWORD OF ONE ALREADY ADDED
+void add_user(struct users *u, char const *username, char const *password) {
+    if (2 * (u->len + 1) > u->num_slots) {
+        usize num_slots = u->num_slots ? u->num_slots * 2 : 64;
+        usize *slots = calloc(num_slots, sizeof(usize));
+        for (usize i = 0; i < u->len; ++i) {
+            *probe_users(u, slots, num_slots, u->users[i].username) = i + 1;
+        }
+        free(u->slots);
+        u->slots = slots;
+        u->num_slots = num_slots;
+    }
+
+    usize *slot = probe_users(u, u->slots, u->num_slots, username);
+    if (*slot) {
+        struct user *user = &u->users[*slot - 1];
+        free(user->password);
+        user->password = strdup(password);
+        return;
+    }
+    if (u->len == u->capacity) {
+        u->capacity = u->capacity ? u->capacity * 2 : 16;
+        u->users = realloc(u->users, u->capacity * sizeof(struct user));
+    }
+    struct user *user = &u->users[u->len];
+    user->username = strdup(username);
+    user->password = strdup(password);
+    user->dir = -1;
+    u->len += 1;
+    *slot = u->len;
+}
+
+// READS "username password" LINES FROM conf AND OPENS root FOR THE ACCOUNT
+// DIRECTORIES TO BE OPENED IN
+int load_users(struct users *u, char const *conf, char const *root) {
+    memset(u, 0, sizeof(struct users));
+    u->root = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (u->root == -1) {
+        println("unable to open root directory %s: %s", root, system_error());
+        return -1;
+    }
+
+    FILE *file = fopen(conf, "r");
+    if (!file) {
+        println("unable to open %s: %s", conf, system_error());
+        return -1;
+    }
+    char *line_buf = NULL;
+    usize line_buf_len = 0;
+    for (isize n = getline(&line_buf, &line_buf_len, file);
+         n != -1;
+         n = getline(&line_buf, &line_buf_len, file))
+    {
+        if (line_buf[n - 1] == '\n') {
+            line_buf[n - 1] = '\0';
+        }
+        char *space = strchr(line_buf, ' ');
+        if (!space) {
+            continue;
+        }
+        *space = '\0';
+        char const *password = space + 1 + strspn(space + 1, " ");
+        add_user(u, line_buf, password);
+    }
+    free(line_buf);
+    fclose(file);
+    TRACE("loaded %zu users", u->len);
+    return 0;
+}
+
+struct user *find_user(struct users const *u, char const *username) {
+    if (u->num_slots == 0) {
+        return NULL;
+    }
+    usize slot = *probe_users(u, u->slots, u->num_slots, username);
+    return slot ? &u->users[slot - 1] : NULL;
+}
+
+// RETURNS THE ACCOUNT username, OR NULL IF THERE IS NONE OR password IS WRONG
+struct user *check_identity(struct users const *u, char const *username, char const *password) {
+    struct user *user = find_user(u, username);
+    if (!user || !strings_equal(user->password, password)) {
+        TRACE("invalid identity %s:%s", username, password);
+        return NULL;
+    }
+    return user;
+}
+
+// RETURNS THE FD OF user'S DIRECTORY, CREATING AND OPENING IT THE FIRST TIME.
+// WORKERS MAY RACE TO OPEN IT: THE FIRST FD STORED WINS AND THE REST ARE
+// CLOSED. RETURNS -1 IF IT CAN'T BE OPENED.
+int user_dir(struct users const *u, struct user *user) {
+    int dir = __atomic_load_n(&user->dir, __ATOMIC_ACQUIRE);
+    if (dir >= 0) {
+        return dir;
+    }
+
+    if (mkdirat(u->root, user->username, 0700) == 0) {
+        TRACE("created user %s dir", user->username);
+    }
+    int fd = openat(u->root, user->username, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        TRACE("unable to open user %s dir: %s", user->username, system_error());
+        return -1;
+    }
+    int expected = -1;
+    if (!__atomic_compare_exchange_n(&user->dir, &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        close(fd);
+        return expected;
+    }
+    return fd;
+}
+
+void drop_users(struct users *u) {
+    for (usize i = 0; i < u->len; ++i) {
+        free(u->users[i].username);
+        free(u->users[i].password);
+        if (u->users[i].dir >= 0) {
+            close(u->users[i].dir);
+        }
+    }
+    if (u->root > 0) {
+        close(u->root);
+    }
+    free(u->users);
+    free(u->slots);
+    memset(u, 0, sizeof(struct users));
+}
@@ -0,0 +1,39 @@
+#ifndef users_h
+#define users_h
+#include "typedefs.h"
+
+// AN ACCOUNT FROM dfs.conf. dir IS THE ACCOUNT'S DIRECTORY UNDER THE SERVER
+// ROOT, OPENED THE FIRST TIME A REQUEST NEEDS IT AND KEPT OPEN, SO EVERY PATH
+// IS RESOLVED RELATIVE TO IT WITHOUT BUILDING OR CHECKING THE FULL PATH. -1
+// UNTIL THEN.
+struct user {
+    char *username;
+    char *password;
+    int dir;
+};
+
+// EVERY ACCOUNT, INDEXED BY AN OPEN-ADDRESSED HASH TABLE OF USERNAMES SO A
+// LOOKUP COSTS THE SAME WITH THOUSANDS OF ACCOUNTS AS WITH ONE. ACCOUNTS ARE
+// ONLY ADDED BEFORE THE SERVER STARTS, SO POINTERS TO THEM STAY VALID.
+struct users {
+    struct user *users;
+    usize len;
+    usize capacity;
+    // INDICES INTO users PLUS ONE, 0 FOR AN EMPTY SLOT
+    usize *slots;
+    usize num_slots;
+    // SERVER ROOT THE ACCOUNT DIRECTORIES ARE OPENED IN
+    int root;
+    // CODECS A PUT MAY BE STORED IN, AS CODEC_BITS. A PUT ENCODED WITH ANY
+    // OTHER IS REFUSED WITH UNSUPPORTED_CODEC, AND THE CLIENT SENDS IT PLAIN.
+    u64 store_codecs;
+};
+
+int load_users(struct users *u, char const *conf, char const *root);
+void add_user(struct users *u, char const *username, char const *password);
+struct user *find_user(struct users const *u, char const *username);
+struct user *check_identity(struct users const *u, char const *username, char const *password);
+int user_dir(struct users const *u, struct user *user);
+void drop_users(struct users *u);
+
+#endif
@@ -6,9 +6,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <assert.h>
-#include <openssl/md5.h>
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 char *make_uppercase(char *s) {
     for (usize i = 0; s[i] != '\0'; ++i) {
@@ -21,28 +25,54 @@ int strings_equal(char const *left, char const *right) {
     return strcmp(left, right) == 0;
 }
 
-int read_file(char const *path, byte **buf, usize *len) {
-    FILE *f = fopen(path, "rb");
-    if (!f) {
+// MAPS ALL OF THE REGULAR FILE path READ-ONLY, SO IT CAN BE WORKED THROUGH A
+// SLICE AT A TIME WITHOUT EVER BEING IN MEMORY ALL AT ONCE. AN EMPTY FILE
+// MAPS TO NULL.
+int map_file(char const *path, byte **buf, usize *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
         return -1;
     }
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    rewind(f);
+    int err = -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        goto cleanup;
+    }
+    *buf = NULL;
+    *len = st.st_size;
+    if (*len > 0) {
+        void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            TRACE("mmap: %s", system_error());
+            goto cleanup;
+        }
+        madvise(p, *len, MADV_SEQUENTIAL);
+        *buf = p;
+    }
+    err = 0;
 
-    *buf = malloc(size);
-    *len = size;
-    usize n = fread(*buf, sizeof(byte), *len, f);
-    if (n != *len) {
-        TRACE("unable to read all of file");
-        fclose(f);
-        free(*buf);
-        return -1;
+cleanup:
+    close(fd);
+    return err;
+}
+
+void unmap_file(byte *buf, usize len) {
+    if (buf) {
+        munmap(buf, len);
     }
+}
 
-    fclose(f);
-    return 0;
+// LETS GO OF THE PAGES OF A MAPPED FILE WHOLLY INSIDE [from, to), WHICH ARE
+// READ BACK FROM THE PAGE CACHE IF THEY ARE TOUCHED AGAIN, SO A PASS OVER A
+// HUGE FILE DOESN'T KEEP ALL OF IT MAPPED IN
+void release_mapped(byte const *buf, usize from, usize to) {
+    usize page = sysconf(_SC_PAGESIZE);
+    usize start = ((usize)buf + from + page - 1) & ~(page - 1);
+    usize end = ((usize)buf + to) & ~(page - 1);
+    if (start < end) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
 }
 
 void print_escaped(byte const *ptr, usize len) {
@@ -57,58 +87,43 @@ void print_escaped(byte const *ptr, usize len) {
     }
 }
 
-usize md5_mod4(byte const *ptr, usize len) {
-    byte digest[MD5_DIGEST_LENGTH] = {0};
-    MD5(ptr, len, digest);
+// THE MD5 OF A FILE, WHICH DECIDES WHERE ITS PARTS GO, WORKED OUT A PIECE
+// AT A TIME AS THE FILE IS READ
+EVP_MD_CTX *start_md5_mod4() {
+    EVP_MD_CTX *md5 = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(md5, EVP_md5(), NULL);
+    return md5;
+}
+
+void update_md5_mod4(EVP_MD_CTX *md5, byte const *ptr, usize len) {
+    EVP_DigestUpdate(md5, ptr, len);
+}
+
+usize finish_md5_mod4(EVP_MD_CTX *md5) {
+    byte digest[EVP_MAX_MD_SIZE] = {0};
+    unsigned digest_len = 0;
+    EVP_DigestFinal_ex(md5, digest, &digest_len);
+    EVP_MD_CTX_free(md5);
 
     usize mod = 0;
-    for (usize i = 0; i < MD5_DIGEST_LENGTH; ++i) {
+    for (usize i = 0; i < digest_len; ++i) {
         mod = (mod * 16 + digest[i]) % 4;
     }
     return mod;
 }
 
-void make_part(byte const *src, usize len, byte **part, usize *partlen, int partn) {
-    *partlen = partn != 3 ? len / 4 : len - (len / 4) * 3;
-    TRACE("total len %zu, partlen %zu", len, *partlen);
-    *part = malloc(*partlen);
-    TRACE("write idx: %zu", (len / 4) * partn);
-    memcpy(*part, src + (len / 4) * partn, *partlen);
+// LENGTH OF PART partn OF A len BYTE FILE, WHICH STARTS partn * (len / 4)
+// BYTES IN. THE LAST PART TAKES THE 0 TO 3 BYTES LEFT OVER.
+usize part_size(usize len, int partn) {
+    return partn != 3 ? len / 4 : len - (len / 4) * 3;
 }
 
 int send_put_request(int fd, struct request const *r) {
-    set_nonblocking(fd, 0);
-    struct request_header rh = {0};
-    rh.start = REQUEST_START;
-    rh.type = PUT;
-    rh.username_len = strlen(r->username);
-    rh.password_len = strlen(r->password);
-    rh.put.path_len = strlen(r->put.path);
-    rh.put.file_len = r->put.file.len;
-
-    { // WRITE REQUEST HEADER
-        isize n = write(fd, &rh, sizeof(struct request_header));
-        if (n == -1) {
-            TRACE("error writing: %s", system_error());
-        }
+    int err = send_request(fd, r);
+    if (err != 0) {
+        TRACE("error sending put request");
     }
-    { // WRITE REQUEST DATA
-        assert(write(fd, r->username, strlen(r->username)) == strlen(r->username));
-        assert(write(fd, r->password, strlen(r->password)) == strlen(r->password));
-        assert(write(fd, r->put.path, strlen(r->put.path)) == strlen(r->put.path));
-        usize sent = 0;
-        while (sent < r->put.file.len) {
-            isize n = write(fd, &r->put.file.buf[sent], r->put.file.len - sent);
-            if (n == -1) {
-                TRACE("error writing file: %s", system_error());
-                return -1;
-            }
-            sent += n;
-        }
-    }
-
-    set_nonblocking(fd, 1);
-    return 0;
+    return err;
 }
 
 char *make_part_path(char const *path, int part) {
@@ -134,6 +149,15 @@ char *make_part_path(char const *path, int part) {
     return part_path;
 }
 
+u64 hash_name(char const *name, usize len) {
+    // FNV-1a
+    u64 h = 0xcbf29ce484222325ULL;
+    for (usize i = 0; i < len; ++i) {
+        h = (h ^ (byte)name[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
 char *join_paths(char const *dir, char const *filename) {
     usize dirlen = strlen(dir);
     usize filenamelen = strlen(filename);
@@ -167,6 +191,69 @@ int write_file(char const *path, byte const *file, usize len) {
     return 0;
 }
 
+// WRITES ALL len BYTES OF buf AT offset IN fd, HOWEVER MANY CALLS IT TAKES
+int pwrite_all(int fd, void const *buf, usize len, u64 offset) {
+    byte const *b = buf;
+    while (len > 0) {
+        isize n = pwrite(fd, b, len, offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TRACE("error writing at %llu: %s", (unsigned long long)offset, system_error());
+            return -1;
+        }
+        b += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// COPIES len BYTES AT from IN in TO to IN out, WHICH MAY BE THE SAME FILE IF
+// THE RANGES DON'T OVERLAP. THE KERNEL COPIES THEM WITHOUT PASSING THEM
+// THROUGH USER SPACE WHERE IT CAN, AND A BUFFER AT A TIME WHERE IT CAN'T.
+int copy_range(int in, u64 from, int out, u64 to, usize len) {
+    while (len > 0) {
+        loff_t in_off = from;
+        loff_t out_off = to;
+        isize n = copy_file_range(in, &in_off, out, &out_off, len, 0);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        from += n;
+        to += n;
+        len -= n;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    usize buf_len = 1 << 16;
+    byte *buf = malloc(buf_len);
+    int err = 0;
+    while (len > 0) {
+        usize want = len < buf_len ? len : buf_len;
+        isize n = pread(in, buf, want, from);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || pwrite_all(out, buf, n, to) != 0) {
+            TRACE("error copying at %llu: %s", (unsigned long long)from, system_error());
+            err = -1;
+            break;
+        }
+        from += n;
+        to += n;
+        len -= n;
+    }
+    free(buf);
+    return err;
+}
+
 char *take_filename(char const *path) {
     char *slash = strrchr(path, '/');
     if (slash == NULL) {
@@ -206,3 +293,24 @@ void xor_file(byte *file, usize len, byte mask) {
         file[i] ^= mask;
     }
 }
+
+// COPIES len BYTES OF src INTO dst, XOR'D WITH mask ON THE WAY
+void xor_copy(byte *dst, byte const *src, usize len, byte mask) {
+    for (usize i = 0; i < len; ++i) {
+        dst[i] = src[i] ^ mask;
+    }
+}
+
+// MILLISECONDS ON THE MONOTONIC CLOCK
+u64 now_ms() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+// MICROSECONDS ON THE MONOTONIC CLOCK, FOR TIMING ROUND TRIPS
+u64 now_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
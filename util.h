@@ -2,28 +2,32 @@
 #define util_h
 #include "typedefs.h"
 #include "request.h"
+#include <openssl/evp.h>
 
 char *make_uppercase(char *s);
 int strings_equal(char const *left, char const *right);
-int read_file(char const *path, byte **buf, usize *len);
+int map_file(char const *path, byte **buf, usize *len);
+void unmap_file(byte *buf, usize len);
+void release_mapped(byte const *buf, usize from, usize to);
 void print_escaped(byte const *ptr, usize len);
-usize md5_mod4(byte const *ptr, usize len);
+EVP_MD_CTX *start_md5_mod4();
+void update_md5_mod4(EVP_MD_CTX *md5, byte const *ptr, usize len);
+usize finish_md5_mod4(EVP_MD_CTX *md5);
 int send_put_request(int fd, struct request const *r);
-void make_part(byte const *src, usize len, byte **part, usize *partlen, int partn);
+usize part_size(usize len, int partn);
 char *make_part_path(char const *path, int part);
+u64 hash_name(char const *name, usize len);
 char *join_paths(char const *dir, char const *filename);
 int write_file(char const *path, byte const *file, usize len);
+int pwrite_all(int fd, void const *buf, usize len, u64 offset);
+int copy_range(int in, u64 from, int out, u64 to, usize len);
 char *take_filename(char const *path);
 char *make_get_filename(char const *path);
 char *unmake_part_filename(char const *part_filename, int *part);
 byte make_mask(char const *password);
 void xor_file(byte *file, usize len, byte mask);
-
-struct users {
-    char **username;
-    char **password;
-    usize len;
-    usize capacity;
-};
+void xor_copy(byte *dst, byte const *src, usize len, byte mask);
+u64 now_ms();
+u64 now_us();
 
 #endif
@@ -0,0 +1,164 @@
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+
+// LENGTH OF v AS A LITTLE-ENDIAN BASE-128 VARINT: 7 BITS PER BYTE, LOWEST
+// GROUP FIRST, HIGH BIT SET ON EVERY BYTE BUT THE LAST.
+usize varint_len(u64 v) {
+    usize len = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        len += 1;
+    }
+    return len;
+}
+
+// LENGTH OF A STRING FIELD: ITS VARINT LENGTH PREFIX PLUS ITS BYTES
+usize string_len(usize len) {
+    return varint_len(len) + len;
+}
+
+void put_byte(struct wire_writer *w, byte b) {
+    *w->p++ = b;
+}
+
+void put_varint(struct wire_writer *w, u64 v) {
+    while (v >= 0x80) {
+        *w->p++ = (byte)v | 0x80;
+        v >>= 7;
+    }
+    *w->p++ = (byte)v;
+}
+
+void put_bytes(struct wire_writer *w, void const *src, usize len) {
+    memcpy(w->p, src, len);
+    w->p += len;
+}
+
+void put_string(struct wire_writer *w, char const *s, usize len) {
+    put_varint(w, len);
+    put_bytes(w, s, len);
+}
+
+void put_u32le(struct wire_writer *w, u32 v) {
+    w->p[0] = v;
+    w->p[1] = v >> 8;
+    w->p[2] = v >> 16;
+    w->p[3] = v >> 24;
+    w->p += 4;
+}
+
+// A TRAILING FIELD THAT IS 0 MAY BE LEFT OFF THE END OF A FRAME
+usize optional_len(u64 v) {
+    return v ? varint_len(v) : 0;
+}
+
+void put_optional(struct wire_writer *w, u64 v) {
+    if (v) {
+        put_varint(w, v);
+    }
+}
+
+// SEVERAL TRAILING FIELDS: ALL ARE WRITTEN UP TO THE LAST ONE THAT ISN'T 0,
+// SO AN EARLIER ONE IS WRITTEN, EVEN AS 0, WHENEVER A LATER ONE IS
+usize optionals_len(u64 const *v, usize count) {
+    while (count > 0 && v[count - 1] == 0) {
+        count -= 1;
+    }
+    usize len = 0;
+    for (usize i = 0; i < count; ++i) {
+        len += varint_len(v[i]);
+    }
+    return len;
+}
+
+void put_optionals(struct wire_writer *w, u64 const *v, usize count) {
+    while (count > 0 && v[count - 1] == 0) {
+        count -= 1;
+    }
+    for (usize i = 0; i < count; ++i) {
+        put_varint(w, v[i]);
+    }
+}
+
+byte get_byte(struct wire_reader *r) {
+    if (r->p >= r->end) {
+        r->error = 1;
+        return 0;
+    }
+    return *r->p++;
+}
+
+u64 get_varint(struct wire_reader *r) {
+    // ONE BYTE COVERS EVERY LENGTH UNDER 128, THE COMMON CASE
+    if (r->p < r->end && *r->p < 0x80) {
+        return *r->p++;
+    }
+    u64 v = 0;
+    for (unsigned shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+        if (r->p >= r->end) {
+            break;
+        }
+        byte b = *r->p++;
+        v |= (u64)(b & 0x7f) << shift;
+        if (b < 0x80) {
+            return v;
+        }
+    }
+    r->error = 1;
+    r->p = r->end;
+    return 0;
+}
+
+// READS A TRAILING FIELD, OR 0 IF THE FRAME ENDS FIRST
+u64 get_optional(struct wire_reader *r) {
+    return r->p < r->end ? get_varint(r) : 0;
+}
+
+// RETURNS len BYTES OF THE FRAME IN PLACE, OR NULL IF IT ISN'T THAT LONG
+byte const *get_bytes(struct wire_reader *r, usize len) {
+    if ((usize)(r->end - r->p) < len) {
+        r->error = 1;
+        r->p = r->end;
+        return NULL;
+    }
+    byte const *p = r->p;
+    r->p += len;
+    return p;
+}
+
+// RETURNS A NUL-TERMINATED COPY OF A STRING FIELD, OR NULL ON A SHORT FRAME
+char *get_string(struct wire_reader *r) {
+    u64 len = get_varint(r);
+    byte const *p = get_bytes(r, len);
+    if (!p) {
+        return NULL;
+    }
+    return strndup((char const *)p, len);
+}
+
+u32 get_u32le(struct wire_reader *r) {
+    byte const *p = get_bytes(r, 4);
+    if (!p) {
+        return 0;
+    }
+    return (u32)p[0] | (u32)p[1] << 8 | (u32)p[2] << 16 | (u32)p[3] << 24;
+}
+
+// DECODES A VARINT AT THE START OF buf WITHOUT CONSUMING IT. RETURNS 1 ON
+// SUCCESS, 0 IF buf ENDS FIRST, -1 IF IT IS LONGER THAN ANY u64.
+int peek_varint(byte const *buf, usize len, u64 *v, usize *varint_bytes) {
+    u64 value = 0;
+    for (usize i = 0; i < VARINT_MAX; ++i) {
+        if (i == len) {
+            return 0;
+        }
+        value |= (u64)(buf[i] & 0x7f) << (7 * i);
+        if (buf[i] < 0x80) {
+            *v = value;
+            *varint_bytes = i + 1;
+            return 1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,51 @@
+#ifndef wire_h
+#define wire_h
+#include "typedefs.h"
+
+// FIRST BYTE OF EVERY V2 FRAME: A MAGIC HIGH NIBBLE AND THE VERSION IN THE
+// LOW NIBBLE. V1 FRAMES START WITH 'R' (REQUESTS) OR 'T' (RESPONSES), WHICH
+// NEVER MATCH THE MAGIC, SO THE FIRST BYTE ALONE TELLS THE VERSIONS APART.
+#define WIRE_MAGIC      0xD0
+#define WIRE_MAGIC_MASK 0xF0
+#define WIRE_V1         1
+#define WIRE_V2         2
+#define WIRE_START_V2   (WIRE_MAGIC | WIRE_V2)
+// LONGEST ENCODING OF A u64
+#define VARINT_MAX      10
+
+// BOUNDS-CHECKED CURSOR OVER A RECEIVED FRAME. READING PAST end SETS error
+// AND YIELDS ZEROES FROM THEN ON, SO A PARSER CAN READ EVERY FIELD AND CHECK
+// error ONCE AT THE END INSTEAD OF AFTER EACH FIELD.
+struct wire_reader {
+    byte const *p;
+    byte const *end;
+    int error;
+};
+
+// CURSOR OVER A BUFFER SIZED BY THE MATCHING *_len FUNCTIONS. WRITERS NEVER
+// CHECK BOUNDS: CALLERS COMPUTE THE EXACT FRAME LENGTH FIRST.
+struct wire_writer {
+    byte *p;
+};
+
+usize varint_len(u64 v);
+usize string_len(usize len);
+void put_byte(struct wire_writer *w, byte b);
+void put_varint(struct wire_writer *w, u64 v);
+void put_bytes(struct wire_writer *w, void const *src, usize len);
+void put_string(struct wire_writer *w, char const *s, usize len);
+void put_u32le(struct wire_writer *w, u32 v);
+usize optional_len(u64 v);
+void put_optional(struct wire_writer *w, u64 v);
+usize optionals_len(u64 const *v, usize count);
+void put_optionals(struct wire_writer *w, u64 const *v, usize count);
+
+byte get_byte(struct wire_reader *r);
+u64 get_varint(struct wire_reader *r);
+u64 get_optional(struct wire_reader *r);
+byte const *get_bytes(struct wire_reader *r, usize len);
+char *get_string(struct wire_reader *r);
+u32 get_u32le(struct wire_reader *r);
+int peek_varint(byte const *buf, usize len, u64 *v, usize *varint_bytes);
+
+#endif